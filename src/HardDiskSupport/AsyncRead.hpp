@@ -0,0 +1,218 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+namespace __cpplib {
+
+using namespace __config;
+
+namespace HardDisk {
+
+    /* bytes.size() bytes to be read from offset */
+    struct read_request {
+        i64 offset;
+        std::span<std::byte> bytes;
+    };
+
+    /* finish a read that came back short or failed, synchronously. stops at the end of the file */
+    inline auto finish_read(int fd, const read_request &request, size_t done) -> void {
+        while (done < request.bytes.size()) {
+            ssize_t n = ::pread(fd, request.bytes.data() + done, request.bytes.size() - done, request.offset + done);
+            if (n < 0 and errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+    }
+
+    /* A bare io_uring used for nothing but reads: requests are queued into the submission ring,
+     * up to its size in flight, and reaped as they complete. One per thread, created on first use;
+     * where the kernel refuses io_uring, open() returns nothing and the caller falls back. */
+    class IoRing {
+        using Self  = IoRing;
+
+        int ring;
+        u32 entries;
+        void *sqMap, *cqMap;
+        size_t sqBytes, cqBytes;
+        io_uring_sqe *sqes;
+        u32 *sqHead, *sqTail, *sqMask, *sqArray;
+        u32 *cqHead, *cqTail, *cqMask;
+        io_uring_cqe *cqes;
+
+        IoRing(): ring(-1), sqMap(MAP_FAILED), cqMap(MAP_FAILED), sqes(static_cast<io_uring_sqe*>(MAP_FAILED)) {}
+
+        static auto load(u32 *p) -> u32 { return std::atomic_ref<u32>(*p).load(std::memory_order_acquire); }
+        static auto store(u32 *p, u32 value) -> void { std::atomic_ref<u32>(*p).store(value, std::memory_order_release); }
+
+    public:
+        static constexpr u32 DEPTH = 64;
+
+        IoRing(const Self &) = delete;
+        ~IoRing() {
+            if (sqes != MAP_FAILED) ::munmap(sqes, entries * sizeof(io_uring_sqe));
+            if (cqMap != MAP_FAILED and cqMap != sqMap) ::munmap(cqMap, cqBytes);
+            if (sqMap != MAP_FAILED) ::munmap(sqMap, sqBytes);
+            if (ring >= 0) ::close(ring);
+        }
+
+        static auto open(u32 depth = DEPTH) -> std::unique_ptr<Self> {
+            std::unique_ptr<Self> self(new Self());
+            io_uring_params params{};
+            if (self->ring = ::syscall(__NR_io_uring_setup, depth, &params); self->ring < 0) return nullptr;
+            self->entries = params.sq_entries;
+            self->sqBytes = params.sq_off.array + params.sq_entries * sizeof(u32);
+            self->cqBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+            if (single) self->sqBytes = self->cqBytes = std::max(self->sqBytes, self->cqBytes);
+
+            self->sqMap = ::mmap(nullptr, self->sqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, self->ring, IORING_OFF_SQ_RING);
+            if (self->sqMap == MAP_FAILED) return nullptr;
+            self->cqMap = single ? self->sqMap : ::mmap(nullptr, self->cqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, self->ring, IORING_OFF_CQ_RING);
+            if (self->cqMap == MAP_FAILED) return nullptr;
+            self->sqes = static_cast<io_uring_sqe*>(::mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, self->ring, IORING_OFF_SQES));
+            if (self->sqes == MAP_FAILED) return nullptr;
+
+            auto sq = static_cast<std::byte*>(self->sqMap), cq = static_cast<std::byte*>(self->cqMap);
+            self->sqHead = reinterpret_cast<u32*>(sq + params.sq_off.head);
+            self->sqTail = reinterpret_cast<u32*>(sq + params.sq_off.tail);
+            self->sqMask = reinterpret_cast<u32*>(sq + params.sq_off.ring_mask);
+            self->sqArray = reinterpret_cast<u32*>(sq + params.sq_off.array);
+            self->cqHead = reinterpret_cast<u32*>(cq + params.cq_off.head);
+            self->cqTail = reinterpret_cast<u32*>(cq + params.cq_off.tail);
+            self->cqMask = reinterpret_cast<u32*>(cq + params.cq_off.ring_mask);
+            self->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+            return self;
+        }
+
+        /* the ring of the calling thread, null if io_uring is not available */
+        static auto local() -> Self* {
+            static std::atomic<bool> unavailable = false;
+            thread_local std::unique_ptr<Self> ring;
+            if (ring == nullptr and not unavailable)
+                if (ring = open(); ring == nullptr) unavailable = true;
+            return ring.get();
+        }
+
+        /* read every request from fd and return once all are done; false if the ring failed
+         * before anything was submitted */
+        auto read_all(int fd, std::span<const read_request> requests) -> bool {
+            size_t submitted = 0, completed = 0;
+            while (completed < requests.size()) {
+                u32 tail = *sqTail, queued = 0;
+                for ( ; submitted < requests.size() and submitted - completed < entries; ++submitted, ++queued) {
+                    const read_request &request = requests[submitted];
+                    u32 index = tail & *sqMask;
+                    io_uring_sqe &sqe = sqes[index];
+                    std::memset(std::addressof(sqe), 0, sizeof(sqe));
+                    sqe.opcode = IORING_OP_READ;
+                    sqe.fd = fd;
+                    sqe.addr = reinterpret_cast<u64>(request.bytes.data());
+                    sqe.len = request.bytes.size();
+                    sqe.off = request.offset;
+                    sqe.user_data = submitted;
+                    sqArray[index] = index;
+                    ++tail;
+                }
+                store(sqTail, tail);
+
+                int entered;
+                do entered = ::syscall(__NR_io_uring_enter, ring, queued, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                while (entered < 0 and errno == EINTR);
+                if (entered < 0) {
+                    if (completed == 0 and submitted == queued) return store(sqTail, tail - queued), false;
+                    throw "in IoRing::read_all(): io_uring_enter failed";
+                }
+
+                for (u32 head = *cqHead; head != load(cqTail); ++head, ++completed) {
+                    const io_uring_cqe &cqe = cqes[head & *cqMask];
+                    finish_read(fd, requests[cqe.user_data], cqe.res < 0 ? 0 : cqe.res);
+                    store(cqHead, head + 1);
+                }
+            } return true;
+        }
+    };
+
+    /* The fallback: a few threads that issue synchronous reads side by side, so that a batch
+     * still keeps more than one read in flight. The calling thread takes part. */
+    class ReadPool {
+        using Self  = ReadPool;
+
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<std::function<void()>> tasks;
+        Vec<std::thread> workers;
+        bool stopping;
+
+        explicit ReadPool(size_t threads): stopping(false) {
+            for (size_t i = 0; i < threads; ++i)
+                workers.emplace_back([this] {
+                    for ( ; ; ) {
+                        std::unique_lock lock(mutex);
+                        cond.wait(lock, [this] { return stopping or not tasks.empty(); });
+                        if (tasks.empty()) return;
+                        auto task = std::move(tasks.front());
+                        tasks.pop_front();
+                        lock.unlock();
+                        task();
+                    }
+                });
+        }
+
+    public:
+        static constexpr size_t THREADS = 8;
+
+        ReadPool(const Self &) = delete;
+        ~ReadPool() {
+            { std::lock_guard guard(mutex); stopping = true; }
+            cond.notify_all();
+            for (auto &worker: workers) worker.join();
+        }
+
+        static auto instance() -> Self& {
+            static ReadPool pool(THREADS);
+            return pool;
+        }
+
+        auto read_all(int fd, std::span<const read_request> requests) -> void {
+            std::atomic<size_t> next = 0;
+            auto work = [&] {
+                for (size_t i; (i = next.fetch_add(1)) < requests.size(); )
+                    finish_read(fd, requests[i], 0);
+            };
+
+            size_t helpers = requests.empty() ? 0 : std::min(workers.size(), requests.size() - 1);
+            std::mutex doneMutex;
+            std::condition_variable doneCond;
+            size_t done = 0;
+            {
+                std::lock_guard guard(mutex);
+                for (size_t i = 0; i < helpers; ++i)
+                    tasks.emplace_back([&] {
+                        work();
+                        std::lock_guard doneGuard(doneMutex);
+                        if (++done == helpers) doneCond.notify_one();
+                    });
+            }
+            cond.notify_all();
+            work();
+            std::unique_lock lock(doneMutex);
+            doneCond.wait(lock, [&] { return done == helpers; });
+        }
+    };
+
+    /* read every request from fd with as many reads in flight as the system allows */
+    inline auto read_all(int fd, std::span<const read_request> requests) -> void {
+        if (requests.empty()) return;
+        if (requests.size() == 1) return finish_read(fd, requests[0], 0);
+        if (IoRing *ring = IoRing::local(); ring != nullptr and ring->read_all(fd, requests)) return;
+        ReadPool::instance().read_all(fd, requests);
+    }
+
+}
+
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "config.hpp"
+#include "FileWrapper.hpp"
+
+namespace __cpplib {
+
+using namespace __config;
+
+namespace HardDisk {
+
+    /* A blocked Bloom filter over 64-bit hashes: a hash picks one cache line of the bit array and
+     * sets a few bits inside it, so that a probe costs a single cache miss. It answers "maybe" or
+     * "no"; an empty filter answers "maybe" to everything. Bits may be set from several threads
+     * at once. Nothing can be taken out, so the owner reports erasures and rebuilds the filter
+     * once stale() says so. Dumped to and restored from a file like the record pools. */
+    class BloomFilter {
+        using Self          = BloomFilter;
+
+        static constexpr u64 BLOCK_BITS = 512;
+        static constexpr u64 BLOCK_WORDS = BLOCK_BITS / 64;
+
+        Vec<u64> words;
+        u64 bitsPerKey, probes;
+        /* keys put in since the last build, and keys the owner erased since */
+        std::atomic<u64> added, erased;
+
+        static auto mix(u64 h) -> u64 {
+            h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ull;
+            h ^= h >> 27; h *= 0x94D049BB133111EBull;
+            return h ^ (h >> 31);
+        }
+
+    public:
+        /* the fewest keys a built filter has room for */
+        static constexpr u64 MIN_KEYS = 1024;
+
+        BloomFilter(): words(), bitsPerKey(0), probes(0), added(0), erased(0) {}
+        BloomFilter(const Self &) = delete;
+
+        /* clear the filter and size it for keys keys at bits bits each */
+        auto build(u64 keys, u64 bits) -> void {
+            u64 blocks = std::bit_ceil((std::max(keys, MIN_KEYS) * bits + BLOCK_BITS - 1) / BLOCK_BITS);
+            words.assign(blocks * BLOCK_WORDS, 0);
+            bitsPerKey = bits;
+            probes = std::clamp<u64>(bits * 69 / 100, 1, 16);
+            added = erased = 0;
+        }
+
+        auto empty() const -> bool { return words.empty(); }
+        auto bits_per_key() const -> u64 { return bitsPerKey; }
+        /* keys currently held, as far as the owner reported them */
+        auto keys() const -> u64 { return added - erased; }
+
+        auto insert(u64 hash) -> void {
+            if (empty()) return;
+            u64 h = mix(hash), *block = words.data() + (h & (words.size() / BLOCK_WORDS - 1)) * BLOCK_WORDS;
+            for (u64 i = 0, bit = h >> 32, step = (h >> 20) | 1; i < probes; ++i, bit += step)
+                std::atomic_ref<u64>(block[bit / 64 % BLOCK_WORDS]).fetch_or(u64(1) << bit % 64, std::memory_order_relaxed);
+            ++added;
+        }
+
+        auto may_contain(u64 hash) const -> bool {
+            if (empty()) return true;
+            u64 h = mix(hash);
+            const u64 *block = words.data() + (h & (words.size() / BLOCK_WORDS - 1)) * BLOCK_WORDS;
+            for (u64 i = 0, bit = h >> 32, step = (h >> 20) | 1; i < probes; ++i, bit += step)
+                if (not (std::atomic_ref<const u64>(block[bit / 64 % BLOCK_WORDS]).load(std::memory_order_relaxed) >> bit % 64 & 1)) return false;
+            return true;
+        }
+
+        auto note_erase() -> void { ++erased; }
+
+        /* worth rebuilding: more keys went in than it was sized for, or most of them are gone */
+        auto stale() const -> bool {
+            if (empty()) return true;
+            u64 room = words.size() * 64 / bitsPerKey;
+            return added > room or (erased > MIN_KEYS and 2 * erased > added);
+        }
+
+        /* number of bytes dump() writes */
+        auto bytes() const -> size_t { return 4 * sizeof(u64) + words.size() * sizeof(u64); }
+
+        auto dump(Vec<std::byte> &out) const -> void {
+            auto put = [&out](const auto &value) {
+                auto bytes = std::as_bytes(std::span(std::addressof(value), 1));
+                out.insert(out.end(), bytes.begin(), bytes.end());
+            };
+            put(bitsPerKey), put(added.load()), put(erased.load()), put(u64(words.size()));
+            auto bits = std::as_bytes(std::span(words));
+            out.insert(out.end(), bits.begin(), bits.end());
+        }
+
+        auto restore(FileWrapper &io) -> void {
+            bitsPerKey = io.template read<u64>();
+            added = io.template read<u64>();
+            erased = io.template read<u64>();
+            words.resize(io.template read<u64>());
+            io.read_bytes(io.tell(), std::as_writable_bytes(std::span(words)));
+            probes = std::clamp<u64>(bitsPerKey * 69 / 100, 1, 16);
+        }
+    };
+
+}
+
+}
@@ -0,0 +1,355 @@
+#pragma once
+
+#include "config.hpp"
+#include "FileWrapper.hpp"
+#include "Record.hpp"
+
+namespace __cpplib {
+
+using namespace __config;
+
+namespace HardDisk {
+
+    /* A version latch for optimistic lock coupling. The low bit of the word is set while a writer
+     * holds the latch and every unlock bumps the version, so a reader can take a version with
+     * read(), look at the protected object without holding anything, and check with validate()
+     * that no writer came in between. Satisfies Lockable for the writers. */
+    struct Latch {
+        std::atomic<u64> word;
+
+        Latch(): word(0) {}
+
+        auto read() const -> u64 {
+            for ( ; ; std::this_thread::yield())
+                if (u64 version = word.load(std::memory_order_acquire); (version & 1) == 0)
+                    return version;
+        }
+        auto validate(u64 version) const -> bool {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return word.load(std::memory_order_relaxed) == version;
+        }
+
+        /* lock only if nothing has changed since version was read */
+        auto try_lock(u64 version) -> bool {
+            return (version & 1) == 0 and word.compare_exchange_strong(version, version | 1, std::memory_order_acquire);
+        }
+        auto try_lock() -> bool { return try_lock(word.load(std::memory_order_relaxed)); }
+        auto lock() -> void { while (not try_lock(read())) ; }
+        auto unlock() -> void { word.fetch_add(1, std::memory_order_release); }
+    };
+
+    /* A byte-budgeted LRU cache of typed objects kept between a container and its FileWrapper.
+     * Every cached object lives in a frame keyed by its file offset; a frame is pinned for as long
+     * as a handle refers to it, and only unpinned frames are eligible for eviction. Dirty frames
+     * are written back when they are evicted or when the pool is flushed. Pinning and unpinning are
+     * thread-safe; what a pinned object may be used for is up to the caller, every frame carries a
+     * Latch for that purpose. */
+    struct BufferPool {
+        using Self          = BufferPool;
+        using offset_type   = Record::offset_type;
+        using size_type     = size_t;
+
+        static constexpr size_type DEFAULT_CAPACITY = size_type(64) << 20;
+
+        template <typename T>
+        class handle;
+        template <typename T>
+        class view;
+
+    private:
+        struct frame;
+        using writer_type   = void (*)(FileWrapper &, const frame &);
+        using imager_type   = auto (*)(const frame &, Vec<std::byte> &) -> std::span<const std::byte>;
+        using lru_type      = std::list<frame*>;
+
+        struct frame {
+            offset_type         offset;
+            size_type           bytes;
+            i32                 pins;
+            std::atomic<bool>   dirty;
+            void                *data;
+            writer_type         writer;
+            imager_type         imager;
+            lru_type::iterator  pos;
+            Latch               latch;
+        };
+
+        FileWrapper &io;
+        mutable std::mutex mutex;
+        size_type limit, used;
+        bool steal;
+        std::unordered_map<offset_type, frame> frames;
+        lru_type lru;
+
+        template <typename T>
+        static auto write_back(FileWrapper &io, const frame &f) -> void {
+            Record(f.offset).save(io, *static_cast<const T*>(f.data));
+        }
+        template <typename T>
+        static auto image_of(const frame &f, Vec<std::byte> &buffer) -> std::span<const std::byte> {
+            return image(*static_cast<const T*>(f.data), buffer);
+        }
+
+        auto acquire(frame &f) -> frame* {
+            if (f.pins++ == 0) lru.erase(f.pos);
+            return std::addressof(f);
+        }
+        auto release(frame *f) -> void {
+            std::lock_guard guard(mutex);
+            if (--f->pins == 0) {
+                f->pos = lru.insert(lru.begin(), f);
+                shrink();
+            }
+        }
+
+        template <typename T>
+        auto emplace(offset_type offset, T *data) -> frame& {
+            frame &f = frames[offset];
+            f.offset = offset;
+            f.bytes = sizeof(T);
+            f.pins = 0;
+            f.dirty = false;
+            f.data = data;
+            f.writer = write_back<T>;
+            f.imager = image_of<T>;
+            f.pos = lru.insert(lru.begin(), std::addressof(f));
+            used += sizeof(T);
+            return f;
+        }
+
+        auto evict(frame &f) -> void {
+            if (f.dirty) f.writer(io, f);
+            lru.erase(f.pos);
+            std::free(f.data);
+            used -= f.bytes;
+            offset_type offset = f.offset;
+            frames.erase(offset);
+        }
+
+        /* evict least recently used frames until we are back under budget; pinned frames
+         * are never on the lru list, and dirty ones are skipped unless stealing is allowed, so
+         * the pool may run over its budget */
+        auto shrink() -> void {
+            for (auto it = lru.end(); used > limit and it != lru.begin(); ) {
+                frame &f = **std::prev(it);
+                if (f.dirty and not steal) --it;
+                else evict(f);
+            }
+        }
+
+    public:
+        explicit BufferPool(FileWrapper &__io, size_type capacity = DEFAULT_CAPACITY)
+            : io(__io), limit(capacity), used(0), steal(true), frames(), lru() {}
+        BufferPool(const Self &) = delete;
+
+        ~BufferPool() { clear(); }
+
+        auto capacity() const -> size_type { std::lock_guard guard(mutex); return limit; }
+        auto usage() const -> size_type { std::lock_guard guard(mutex); return used; }
+        auto resize(size_type capacity) -> void { std::lock_guard guard(mutex); limit = capacity; shrink(); }
+
+        /* whether the pool is past its budget on account of dirty frames it may not evict */
+        auto overfull() const -> bool { std::lock_guard guard(mutex); return used > limit; }
+
+        /* with keep set, dirty frames are only written back by flush(), never by eviction */
+        auto keep_dirty(bool keep) -> void { std::lock_guard guard(mutex); steal = not keep; shrink(); }
+
+        /* f(offset, bytes) for every dirty frame, with the bytes it is to be stored as. the objects
+         * must not be modified meanwhile */
+        template <typename F>
+        auto for_each_dirty(F &&f) const -> void {
+            std::lock_guard guard(mutex);
+            Vec<std::byte> buffer;
+            for (auto &[offset, g]: frames)
+                if (g.dirty) f(offset, g.imager(g, buffer));
+        }
+
+        /* load the object stored at rec through the cache and pin it, with its latch held if
+         * exclusive is set */
+        template <typename T>
+        auto pin(const Record &rec, bool exclusive = false) -> handle<T> {
+            if (rec.empty()) throw "try to pin an empty record";
+            frame *f;
+            {
+                std::lock_guard guard(mutex);
+                if (auto it = frames.find(rec.offset); it != frames.end())
+                    f = acquire(it->second);
+                else {
+                    T *value = static_cast<T*>(std::malloc(sizeof(T)));
+                    rec.load(io, *value);
+                    f = acquire(emplace(rec.offset, value));
+                }
+            }
+            if (exclusive) f->latch.lock();
+            return handle<T>(this, f, exclusive);
+        }
+
+        /* pin the objects at recs, the ones not cached are read as a single batch */
+        template <typename T>
+        auto pin_batch(std::span<const Record> recs) -> Vec<handle<T>> {
+            Vec<handle<T>> pinned(recs.size());
+            Vec<size_t> missing;
+            {
+                std::lock_guard guard(mutex);
+                for (size_t i = 0; i < recs.size(); ++i) {
+                    if (recs[i].empty()) throw "try to pin an empty record";
+                    if (auto it = frames.find(recs[i].offset); it != frames.end())
+                        pinned[i] = handle<T>(this, acquire(it->second));
+                    else missing.push_back(i);
+                }
+            }
+            if (missing.empty()) return pinned;
+
+            Vec<T*> loaded;
+            Vec<read_request> requests;
+            /* an encoded object is read as its image and decoded after */
+            Vec<std::conditional_t<encoded<T>, file_image<T>, std::byte>> images(encoded<T> ? missing.size() : 0);
+            for (size_t j = 0; j < missing.size(); ++j) {
+                loaded.push_back(static_cast<T*>(std::malloc(sizeof(T))));
+                if constexpr (encoded<T>) requests.push_back({ recs[missing[j]].offset, std::as_writable_bytes(std::span(std::addressof(images[j]), 1)) });
+                else requests.push_back({ recs[missing[j]].offset, std::as_writable_bytes(std::span(loaded.back(), 1)) });
+            }
+            io.read_batch(requests);
+            if constexpr (encoded<T>)
+                for (size_t j = 0; j < missing.size(); ++j) loaded[j]->decode(images[j].bytes);
+
+            std::lock_guard guard(mutex);
+            for (size_t j = 0; j < missing.size(); ++j) {
+                const Record &rec = recs[missing[j]];
+                /* somebody else may have loaded it meanwhile */
+                if (auto it = frames.find(rec.offset); it != frames.end())
+                    std::free(loaded[j]), pinned[missing[j]] = handle<T>(this, acquire(it->second));
+                else pinned[missing[j]] = handle<T>(this, acquire(emplace(rec.offset, loaded[j])));
+            } return pinned;
+        }
+
+        /* read-only access to the object at rec. a cached copy is pinned as usual; otherwise a
+         * mapped file is read in place, unless the object is encoded, and nothing is loaded into
+         * the cache. the object must not be written to through another path while the view is
+         * alive */
+        template <typename T>
+        auto peek(const Record &rec) -> view<T> {
+            if constexpr (FileWrapper::MAPPED and not encoded<T>) {
+                if (rec.empty()) throw "try to peek at an empty record";
+                std::lock_guard guard(mutex);
+                if (auto it = frames.find(rec.offset); it != frames.end())
+                    return view<T>(handle<T>(this, acquire(it->second)));
+                return view<T>(rec.template view<T>(io));
+            } else return view<T>(pin<T>(rec));
+        }
+
+        /* place a default constructed object at rec and pin it, an empty rec is assigned a
+         * fresh offset at the end of the file */
+        template <typename T>
+        auto create(Record &rec, bool exclusive = false) -> handle<T> {
+            frame *f;
+            bool fresh = rec.empty();
+            {
+                std::lock_guard guard(mutex);
+                if (fresh) {
+                    T *value = new (std::malloc(sizeof(T))) T();
+                    rec.save(io, *value);
+                    f = acquire(emplace(rec.offset, value));
+                } else {
+                    auto it = frames.find(rec.offset);
+                    f = acquire(it != frames.end() ? it->second : emplace(rec.offset, static_cast<T*>(std::malloc(sizeof(T)))));
+                }
+            }
+            if (exclusive) f->latch.lock();
+            if (not fresh) new (f->data) T(), f->dirty = true;
+            return handle<T>(this, f, exclusive);
+        }
+
+        /* the object at rec is no longer in use, so there is no need to write it back */
+        auto discard(const Record &rec) -> void {
+            std::lock_guard guard(mutex);
+            if (auto it = frames.find(rec.offset); it != frames.end())
+                it->second.dirty = false;
+        }
+
+        auto flush() -> void {
+            std::lock_guard guard(mutex);
+            for (auto &[offset, f]: frames)
+                if (f.dirty) f.writer(io, f), f.dirty = false;
+            shrink();
+        }
+
+        auto clear() -> void {
+            flush();
+            std::lock_guard guard(mutex);
+            for (auto &[offset, f]: frames) std::free(f.data);
+            frames.clear();
+            lru.clear();
+            used = 0;
+        }
+    };
+
+    template <typename T>
+    class BufferPool::handle {
+        using Up    = BufferPool;
+        using Self  = handle;
+
+        Up      *up;
+        frame   *f;
+        bool    locked;
+
+    public:
+        handle(): up(nullptr), f(nullptr), locked(false) {}
+        handle(Up *__up, frame *__f, bool __locked = false): up(__up), f(__f), locked(__locked) {}
+        handle(Self &&other): up(std::exchange(other.up, nullptr)), f(std::exchange(other.f, nullptr)), locked(std::exchange(other.locked, false)) {}
+        handle(const Self &) = delete;
+
+        ~handle() { release(); }
+
+        auto operator = (Self &&rhs) -> Self& {
+            if (this != std::addressof(rhs)) {
+                release();
+                up = std::exchange(rhs.up, nullptr);
+                f = std::exchange(rhs.f, nullptr);
+                locked = std::exchange(rhs.locked, false);
+            } return *this;
+        }
+
+        auto get() const -> T* { return static_cast<T*>(f->data); }
+        auto operator -> () const -> T* { return get(); }
+        auto operator * () const -> T& { return *get(); }
+
+        auto empty() const -> bool { return f == nullptr; }
+        auto record() const -> Record { return Record(f->offset); }
+
+        /* the pinned object was modified and must be written back before eviction */
+        auto dirty() const -> void { f->dirty = true; }
+
+        auto latch() const -> Latch& { return f->latch; }
+
+        /* take the latch of the pinned object if it is still at version, it is released together
+         * with the pin */
+        auto upgrade(u64 version) -> bool { return locked = f->latch.try_lock(version); }
+
+        auto release() -> void {
+            if (locked) f->latch.unlock();
+            if (f != nullptr) up->release(f);
+            up = nullptr, f = nullptr, locked = false;
+        }
+    };
+
+    template <typename T>
+    class BufferPool::view {
+        using Self  = view;
+
+        handle<T>   pinned;
+        const T     *data;
+
+    public:
+        view(): pinned(), data(nullptr) {}
+        explicit view(handle<T> &&__pinned): pinned(std::move(__pinned)), data(pinned.get()) {}
+        explicit view(const T *__data): pinned(), data(__data) {}
+
+        auto get() const -> const T* { return data; }
+        auto operator -> () const -> const T* { return get(); }
+        auto operator * () const -> const T& { return *get(); }
+    };
+
+}
+
+}
@@ -1,22 +1,517 @@
 #pragma once
 
 #include "config.hpp"
+#include "AsyncRead.hpp"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 namespace __cpplib {
 
 using namespace __config;
 
+#if not defined(POSIX_HardDiskIO) and not defined(MMAP_HardDiskIO) and not defined(DIRECT_HardDiskIO)
 #define C_STYLE_HardDiskIO
+#endif
 
 namespace HardDisk {
 
-#ifdef C_STYLE_HardDiskIO
+    /* how the file is about to be read, passed on to the kernel as a readahead hint */
+    enum class access { normal, random, sequential };
+
+    /* a type that declares FILE_ALIGNMENT is appended at a multiple of it and padded up to one */
+    template <typename T>
+    constexpr auto file_alignment() -> i64 {
+        if constexpr (requires { T::FILE_ALIGNMENT; }) return std::max<i64>(T::FILE_ALIGNMENT, 1);
+        else return 1;
+    }
+    constexpr auto align_up(i64 offset, i64 alignment) -> i64 { return (offset + alignment - 1) / alignment * alignment; }
+
+#if defined(MMAP_HardDiskIO)
 
+    /* the file mapped shared into an address range reserved once, so that the mapping never
+     * moves and pointers into it stay valid while the file grows. it grows GROW_CHUNK bytes at a
+     * time and is cut back to the bytes in use when closed. reads and writes are plain copies
+     * into the mapping and view() hands out the stored object in place */
     struct FileWrapper {
         using Self          = FileWrapper;
         using offset_type   = i64;
 
+        static constexpr bool MAPPED = true;
+        static constexpr size_t RESERVE = size_t(1) << 40;
+        static constexpr offset_type GROW_CHUNK = offset_type(64) << 20;
+
+        int fd;
+        std::byte *base;
+        offset_type pos;
+        /* end of the file in use, and of the part mapped; the file on disk is as long as the
+         * mapping */
+        std::atomic<offset_type> end, mapped;
+        access advice;
+        std::mutex mutex;
+
+        FileWrapper(): fd(-1), base(nullptr), pos(0), end(0), mapped(0), advice(access::normal) { }
+        explicit FileWrapper(const char *filename): FileWrapper() { open(filename); }
+        explicit FileWrapper(const std::string &filename): FileWrapper() { open(filename.c_str()); }
+
+        FileWrapper(Self &&other): fd(std::exchange(other.fd, -1)), base(std::exchange(other.base, nullptr)), pos(other.pos),
+            end(other.end.load()), mapped(other.mapped.load()), advice(other.advice) { }
+        FileWrapper(const Self &) = delete;
+
+        ~FileWrapper() { if (fd >= 0) close(); }
+
+        auto open(const char *filename) -> bool {
+            bool existing = true;
+            if (fd = ::open(filename, O_RDWR); fd < 0)
+                fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644), existing = false;
+            if (fd < 0) return false;
+            void *area = ::mmap(nullptr, RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (area == MAP_FAILED) throw "in FileWrapper::open(): cannot reserve the address range";
+            base = static_cast<std::byte*>(area);
+            struct stat st;
+            end = ::fstat(fd, &st) == 0 ? st.st_size : 0;
+            mapped = 0, pos = 0;
+            reserve(end);
+            return existing;
+        }
+        auto open(const std::string &filename) -> bool { return open(filename.c_str()); }
+
+        auto is_open() const -> bool { return fd >= 0; }
+        auto close() -> void {
+            /* should this fail the file merely keeps its padding */
+            if (::ftruncate(fd, end) != 0) { }
+            ::munmap(base, RESERVE);
+            ::close(fd);
+            fd = -1, base = nullptr;
+        }
+        /* writes land in the page cache directly */
+        auto flush() -> void { }
+        auto sync() -> void { ::msync(base, mapped, MS_SYNC); }
+
+        auto advise(access pattern) -> void {
+            advice = pattern;
+            if (mapped > 0) ::madvise(base, mapped, hint(pattern));
+        }
+
+        auto tell() const -> offset_type { return pos; }
+        auto seek(offset_type offset) -> void { pos = offset == -1 ? end.load() : offset; }
+
+        template <typename T>
+        auto read() -> T {
+            T value;
+            read(value);
+            return value;
+        }
+
+        template <typename T>
+        auto read(T &obj) -> void {
+            read_at(pos, obj);
+            pos += sizeof(T);
+        }
+
+        template <typename T>
+        auto write(const T &obj) -> void {
+            write_at(pos, obj);
+            pos += sizeof(T);
+        }
+
+        template <typename T>
+        auto read_at(offset_type offset, T &obj) -> void {
+            read_bytes(offset, std::as_writable_bytes(std::span(std::addressof(obj), 1)));
+        }
+
+        template <typename T>
+        auto write_at(offset_type offset, const T &obj) -> void {
+            write_bytes(offset, std::as_bytes(std::span(std::addressof(obj), 1)));
+        }
+
+        /* the object stored at offset, valid until the file is closed */
+        template <typename T>
+        auto view(offset_type offset) const -> const T* { return reinterpret_cast<const T*>(base + offset); }
+
+        auto read_bytes(offset_type offset, std::span<std::byte> bytes) -> size_t {
+            size_t n = std::clamp<offset_type>(end.load() - offset, 0, bytes.size());
+            std::memcpy(bytes.data(), base + offset, n);
+            return n;
+        }
+
+        auto write_bytes(offset_type offset, std::span<const std::byte> bytes) -> void {
+            offset_type to = offset + bytes.size();
+            reserve(to);
+            std::memcpy(base + offset, bytes.data(), bytes.size());
+            for (offset_type e = end.load(); e < to and not end.compare_exchange_weak(e, to); ) ;
+        }
+
+        /* the pages are asked for all at once, then copied */
+        auto read_batch(std::span<const read_request> requests) -> void {
+            offset_type page = ::sysconf(_SC_PAGESIZE);
+            for (const read_request &request: requests)
+                if (request.offset < end.load())
+                    ::madvise(base + request.offset / page * page, request.offset % page + request.bytes.size(), MADV_WILLNEED);
+            for (const read_request &request: requests) read_bytes(request.offset, request.bytes);
+        }
+
+        auto size() -> offset_type { return end.load(); }
+
+        auto resize(offset_type bytes) -> void {
+            std::lock_guard guard(mutex);
+            if (::ftruncate(fd, bytes) != 0) throw "in FileWrapper::resize(): ftruncate failed";
+            /* whatever is mapped past the new end is not touched again until reserve() maps it anew */
+            end = bytes, mapped = bytes;
+        }
+
+        template <typename T>
+        auto append(const T &obj) -> offset_type {
+            constexpr offset_type alignment = file_alignment<T>();
+            offset_type e = end.load(), offset;
+            do offset = align_up(e, alignment);
+            while (not end.compare_exchange_weak(e, offset + align_up(sizeof(T), alignment)));
+            write_at(offset, obj);
+            return offset;
+        }
+
+    private:
+        static auto hint(access pattern) -> int {
+            return pattern == access::random ? MADV_RANDOM : pattern == access::sequential ? MADV_SEQUENTIAL : MADV_NORMAL;
+        }
+
+        /* make sure [0, to) is mapped, growing the file and the mapping by whole chunks */
+        auto reserve(offset_type to) -> void {
+            if (to <= mapped.load()) return;
+            std::lock_guard guard(mutex);
+            if (to <= mapped.load()) return;
+            offset_type page = ::sysconf(_SC_PAGESIZE);
+            offset_type from = mapped.load() / page * page, length = (to + GROW_CHUNK - 1) / GROW_CHUNK * GROW_CHUNK;
+            if (size_t(length) > RESERVE) throw "in FileWrapper::reserve(): file outgrew the reserved address range";
+            if (::ftruncate(fd, length) != 0) throw "in FileWrapper::reserve(): ftruncate failed";
+            if (::mmap(base + from, length - from, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, from) == MAP_FAILED)
+                throw "in FileWrapper::reserve(): mmap failed";
+            ::madvise(base + from, length - from, hint(advice));
+            mapped = length;
+        }
+    };
+
+#elif defined(DIRECT_HardDiskIO)
+
+    /* O_DIRECT: transfers bypass the page cache, so the file is cached once, by the BufferPool
+     * above it. everything moves through block-aligned bounce buffers. objects of PAD_BYTES or
+     * more (the nodes) are appended on a block boundary and padded to whole blocks, so each of
+     * them is a single aligned transfer that shares no block with anything else; smaller ones are
+     * packed, and a write that covers a block only partly reads it back first. where the file
+     * system refuses O_DIRECT this is plain descriptor I/O with the same layout */
+    struct FileWrapper {
+        using Self          = FileWrapper;
+        using offset_type   = i64;
+
+        static constexpr bool MAPPED = false;
+        static constexpr offset_type BLOCK = 4096;
+        static constexpr size_t PAD_BYTES = BLOCK / 4;
+
+        int fd;
+        bool direct;
+        offset_type pos;
+        std::atomic<offset_type> end;
+        /* taken by writes that read-modify-write a block */
+        std::mutex mutex;
+
+        FileWrapper(): fd(-1), direct(false), pos(0), end(0) { }
+        explicit FileWrapper(const char *filename): FileWrapper() { open(filename); }
+        explicit FileWrapper(const std::string &filename): FileWrapper() { open(filename.c_str()); }
+
+        FileWrapper(Self &&other): fd(std::exchange(other.fd, -1)), direct(other.direct), pos(other.pos), end(other.end.load()) { }
+        FileWrapper(const Self &) = delete;
+
+        ~FileWrapper() { if (fd >= 0) close(); }
+
+        auto open(const char *filename) -> bool {
+            bool existing = true;
+            direct = true;
+            if (fd = ::open(filename, O_RDWR | O_DIRECT); fd < 0 and errno == EINVAL)
+                fd = ::open(filename, O_RDWR), direct = false;
+            if (fd < 0) {
+                existing = false, direct = true;
+                if (fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0644); fd < 0 and errno == EINVAL)
+                    fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644), direct = false;
+            }
+            struct stat st;
+            end = (fd >= 0 and ::fstat(fd, &st) == 0) ? st.st_size : 0;
+            pos = 0;
+            return existing;
+        }
+        auto open(const std::string &filename) -> bool { return open(filename.c_str()); }
+
+        auto is_open() const -> bool { return fd >= 0; }
+        /* the last block is written whole, cut the file back to what is in use */
+        auto close() -> void {
+            /* should this fail the file merely keeps its padding */
+            if (::ftruncate(fd, end) != 0) { }
+            ::close(fd);
+            fd = -1;
+        }
+        auto flush() -> void { }
+        auto sync() -> void { ::fsync(fd); }
+        auto advise(access pattern) -> void {
+            if (not direct)
+                ::posix_fadvise(fd, 0, 0, pattern == access::random ? POSIX_FADV_RANDOM : pattern == access::sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+        }
+
+        auto tell() const -> offset_type { return pos; }
+        auto seek(offset_type offset) -> void { pos = offset == -1 ? end.load() : offset; }
+
+        template <typename T>
+        auto read() -> T {
+            T value;
+            read(value);
+            return value;
+        }
+
+        template <typename T>
+        auto read(T &obj) -> void {
+            read_at(pos, obj);
+            pos += sizeof(T);
+        }
+
+        template <typename T>
+        auto write(const T &obj) -> void {
+            write_at(pos, obj);
+            pos += sizeof(T);
+        }
+
+        template <typename T>
+        auto read_at(offset_type offset, T &obj) -> void {
+            read_bytes(offset, std::as_writable_bytes(std::span(std::addressof(obj), 1)));
+        }
+
+        template <typename T>
+        auto write_at(offset_type offset, const T &obj) -> void {
+            write_bytes(offset, std::as_bytes(std::span(std::addressof(obj), 1)));
+        }
+
+        auto read_bytes(offset_type offset, std::span<std::byte> bytes) -> size_t {
+            offset_type lo = align_down(offset), hi = align_up(offset + bytes.size());
+            bounce scratch(hi - lo);
+            std::byte *buffer = scratch.data;
+            offset_type got = transfer(::pread, buffer, hi - lo, lo);
+            size_t n = std::clamp<offset_type>(std::min(got, end.load() - lo) - (offset - lo), 0, bytes.size());
+            std::memcpy(bytes.data(), buffer + (offset - lo), n);
+            return n;
+        }
+
+        auto write_bytes(offset_type offset, std::span<const std::byte> bytes) -> void {
+            offset_type lo = align_down(offset), hi = align_up(offset + bytes.size());
+            bounce scratch(hi - lo);
+            std::byte *buffer = scratch.data;
+            std::unique_lock<std::mutex> guard;
+            if (offset != lo or offset_type(offset + bytes.size()) != hi) {
+                guard = std::unique_lock(mutex);
+                std::memset(buffer, 0, BLOCK), std::memset(buffer + (hi - lo - BLOCK), 0, BLOCK);
+                if (offset != lo) transfer(::pread, buffer, BLOCK, lo);
+                if (offset_type(offset + bytes.size()) != hi and (hi - lo > BLOCK or offset == lo))
+                    transfer(::pread, buffer + (hi - lo - BLOCK), BLOCK, hi - BLOCK);
+            }
+            std::memcpy(buffer + (offset - lo), bytes.data(), bytes.size());
+            if (transfer(::pwrite, buffer, hi - lo, lo) != hi - lo) throw "in FileWrapper::write_bytes(): pwrite failed";
+            offset_type to = offset + bytes.size();
+            for (offset_type e = end.load(); e < to and not end.compare_exchange_weak(e, to); ) ;
+        }
+
+        /* the requests are widened to whole blocks in one aligned buffer and read together */
+        auto read_batch(std::span<const read_request> requests) -> void {
+            Vec<read_request> blocks;
+            offset_type total = 0;
+            for (const read_request &request: requests)
+                total += align_up(request.offset + request.bytes.size()) - align_down(request.offset);
+            bounce scratch(total);
+            std::byte *at = scratch.data;
+            for (const read_request &request: requests) {
+                offset_type lo = align_down(request.offset), hi = align_up(request.offset + request.bytes.size());
+                blocks.push_back({ lo, std::span(at, hi - lo) });
+                at += hi - lo;
+            }
+            read_all(fd, blocks);
+            for (size_t i = 0; i < requests.size(); ++i) {
+                const read_request &request = requests[i];
+                size_t n = std::clamp<offset_type>(end.load() - request.offset, 0, request.bytes.size());
+                std::memcpy(request.bytes.data(), blocks[i].bytes.data() + (request.offset - blocks[i].offset), n);
+            }
+        }
+
+        auto size() -> offset_type { return end.load(); }
+
+        auto resize(offset_type bytes) -> void {
+            std::lock_guard guard(mutex);
+            if (::ftruncate(fd, bytes) != 0) throw "in FileWrapper::resize(): ftruncate failed";
+            end = bytes;
+        }
+
+        /* large objects start on a fresh block and own every block they touch */
+        template <typename T>
+        auto append(const T &obj) -> offset_type {
+            constexpr offset_type alignment = std::max(file_alignment<T>(), sizeof(T) >= PAD_BYTES ? BLOCK : 1);
+            offset_type e = end.load(), offset;
+            do offset = HardDisk::align_up(e, alignment);
+            while (not end.compare_exchange_weak(e, offset + HardDisk::align_up(sizeof(T), alignment)));
+            write_at(offset, obj);
+            return offset;
+        }
+
+    private:
+        static auto align_down(offset_type offset) -> offset_type { return offset / BLOCK * BLOCK; }
+        static auto align_up(offset_type offset) -> offset_type { return (offset + BLOCK - 1) / BLOCK * BLOCK; }
+
+        /* an aligned scratch buffer, on the stack unless the transfer is large */
+        struct bounce {
+            alignas(BLOCK) std::byte local[2 * BLOCK];
+            std::byte *data;
+
+            explicit bounce(size_t bytes): data(bytes <= sizeof(local) ? local : static_cast<std::byte*>(std::aligned_alloc(BLOCK, bytes))) { }
+            bounce(const bounce &) = delete;
+            ~bounce() { if (data != local) std::free(data); }
+        };
+
+        /* pread or pwrite all of [offset, offset + bytes), short only at the end of the file */
+        template <typename F, typename Buffer>
+        auto transfer(F &&f, Buffer *buffer, offset_type bytes, offset_type offset) -> offset_type {
+            offset_type done = 0;
+            while (done < bytes) {
+                ssize_t n = f(fd, buffer + done, bytes - done, offset + done);
+                if (n < 0 and errno == EINTR) continue;
+                if (n <= 0) break;
+                done += n;
+            } return done;
+        }
+    };
+
+#elif defined(POSIX_HardDiskIO)
+
+    /* a raw descriptor driven by pread/pwrite: nothing is buffered in user space and there is no
+     * shared position, so reads and writes at an explicit offset need no lock. the sequential
+     * interface keeps a position of its own and is for one thread at a time */
+    struct FileWrapper {
+        using Self          = FileWrapper;
+        using offset_type   = i64;
+
+        static constexpr bool MAPPED = false;
+
+        int fd;
+        offset_type pos;
+        /* end of the file, appends claim their range from it */
+        std::atomic<offset_type> end;
+
+        FileWrapper(): fd(-1), pos(0), end(0) { }
+        explicit FileWrapper(const char *filename): FileWrapper() { open(filename); }
+        explicit FileWrapper(const std::string &filename): FileWrapper() { open(filename.c_str()); }
+
+        FileWrapper(Self &&other): fd(other.fd), pos(other.pos), end(other.end.load()) { other.fd = -1; }
+        FileWrapper(const Self &) = delete;
+
+        ~FileWrapper() { if (fd >= 0) ::close(fd); }
+
+        auto open(const char *filename) -> bool {
+            bool existing = true;
+            if (fd = ::open(filename, O_RDWR); fd < 0)
+                fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644), existing = false;
+            struct stat st;
+            end = (fd >= 0 and ::fstat(fd, &st) == 0) ? st.st_size : 0;
+            pos = 0;
+            return existing;
+        }
+        auto open(const std::string &filename) -> bool { return open(filename.c_str()); }
+
+        auto is_open() const -> bool { return fd >= 0; }
+        auto close() -> void { ::close(fd); fd = -1; }
+        auto flush() -> void { }
+        auto sync() -> void { ::fsync(fd); }
+        auto advise(access pattern) -> void {
+            ::posix_fadvise(fd, 0, 0, pattern == access::random ? POSIX_FADV_RANDOM : pattern == access::sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+        }
+
+        auto tell() const -> offset_type { return pos; }
+        auto seek(offset_type offset) -> void { pos = offset == -1 ? end.load() : offset; }
+
+        template <typename T>
+        auto read() -> T {
+            T value;
+            read(value);
+            return value;
+        }
+
+        template <typename T>
+        auto read(T &obj) -> void {
+            read_at(pos, obj);
+            pos += sizeof(T);
+        }
+
+        template <typename T>
+        auto write(const T &obj) -> void {
+            write_at(pos, obj);
+            pos += sizeof(T);
+        }
+
+        template <typename T>
+        auto read_at(offset_type offset, T &obj) -> void {
+            read_bytes(offset, std::as_writable_bytes(std::span(std::addressof(obj), 1)));
+        }
+
+        template <typename T>
+        auto write_at(offset_type offset, const T &obj) -> void {
+            write_bytes(offset, std::as_bytes(std::span(std::addressof(obj), 1)));
+        }
+
+        auto read_bytes(offset_type offset, std::span<std::byte> bytes) -> size_t {
+            size_t done = 0;
+            while (done < bytes.size()) {
+                ssize_t n = ::pread(fd, bytes.data() + done, bytes.size() - done, offset + done);
+                if (n < 0 and errno == EINTR) continue;
+                if (n <= 0) break;
+                done += n;
+            } return done;
+        }
+
+        auto write_bytes(offset_type offset, std::span<const std::byte> bytes) -> void {
+            for (size_t done = 0; done < bytes.size(); ) {
+                ssize_t n = ::pwrite(fd, bytes.data() + done, bytes.size() - done, offset + done);
+                if (n < 0 and errno == EINTR) continue;
+                if (n <= 0) throw "in FileWrapper::write_bytes(): pwrite failed";
+                done += n;
+            }
+            offset_type to = offset + bytes.size();
+            for (offset_type e = end.load(); e < to and not end.compare_exchange_weak(e, to); ) ;
+        }
+
+        /* issued together, see read_all() */
+        auto read_batch(std::span<const read_request> requests) -> void { HardDisk::read_all(fd, requests); }
+
+        auto size() -> offset_type { return end.load(); }
+
+        auto resize(offset_type bytes) -> void {
+            if (::ftruncate(fd, bytes) != 0) throw "in FileWrapper::resize(): ftruncate failed";
+            end = bytes;
+        }
+
+        template <typename T>
+        auto append(const T &obj) -> offset_type {
+            constexpr offset_type alignment = file_alignment<T>();
+            offset_type e = end.load(), offset;
+            do offset = align_up(e, alignment);
+            while (not end.compare_exchange_weak(e, offset + align_up(sizeof(T), alignment)));
+            write_at(offset, obj);
+            return offset;
+        }
+    };
+
+#elif defined(C_STYLE_HardDiskIO)
+
+    struct FileWrapper {
+        using Self          = FileWrapper;
+        using offset_type   = i64;
+
+        static constexpr bool MAPPED = false;
+
         std::FILE *file;
+        std::mutex mutex;
 
         FileWrapper(): file(nullptr) { }
         explicit FileWrapper(const char *filename) { open(filename); }
@@ -37,6 +532,11 @@ namespace HardDisk {
         auto is_open() const -> bool { return file != nullptr; }
         auto close() -> void { std::fclose(file); }
         auto flush() -> void { std::fflush(file); }
+        /* flush and wait until the data has reached the disk */
+        auto sync() -> void { flush(); ::fsync(::fileno(file)); }
+        auto advise(access pattern) -> void {
+            ::posix_fadvise(::fileno(file), 0, 0, pattern == access::random ? POSIX_FADV_RANDOM : pattern == access::sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+        }
 
         auto tell() const -> offset_type { return std::ftell(file); }
         auto seek(offset_type offset) -> void {
@@ -63,11 +563,62 @@ namespace HardDisk {
             std::fwrite(std::addressof(obj), sizeof(T), 1, file);
         }
 
+        /* reads and writes that do not depend on the current position, these and append() may be
+         * called from several threads at once */
+        template <typename T>
+        auto read_at(offset_type offset, T &obj) -> void {
+            std::lock_guard guard(mutex);
+            seek(offset);
+            read(obj);
+        }
+
+        template <typename T>
+        auto write_at(offset_type offset, const T &obj) -> void {
+            std::lock_guard guard(mutex);
+            seek(offset);
+            write(obj);
+        }
+
+        auto read_bytes(offset_type offset, std::span<std::byte> bytes) -> size_t {
+            std::lock_guard guard(mutex);
+            seek(offset);
+            return std::fread(bytes.data(), 1, bytes.size(), file);
+        }
+
+        auto write_bytes(offset_type offset, std::span<const std::byte> bytes) -> void {
+            std::lock_guard guard(mutex);
+            seek(offset);
+            std::fwrite(bytes.data(), 1, bytes.size(), file);
+        }
+
+        /* one after the other, the stream has a single position */
+        auto read_batch(std::span<const read_request> requests) -> void {
+            for (const read_request &request: requests) read_bytes(request.offset, request.bytes);
+        }
+
+        auto size() -> offset_type {
+            std::lock_guard guard(mutex);
+            seek(-1);
+            return tell();
+        }
+
+        auto resize(offset_type bytes) -> void {
+            std::lock_guard guard(mutex);
+            flush();
+            if (::ftruncate(::fileno(file), bytes) != 0) throw "in FileWrapper::resize(): ftruncate failed";
+        }
+
         template <typename T>
         auto append(const T &obj) -> offset_type {
+            constexpr offset_type alignment = file_alignment<T>();
+            std::lock_guard guard(mutex);
             seek(-1);
-            offset_type offset = tell();
+            offset_type offset = align_up(tell(), alignment);
+            seek(offset);
             write(obj);
+            /* the padding is written too, so that the next append starts past it */
+            if (offset_type pad = align_up(sizeof(T), alignment) - sizeof(T); pad > 0)
+                seek(offset + sizeof(T) + pad - 1), write(std::byte(0));
             return offset;
         }
     };
@@ -78,18 +629,23 @@ namespace HardDisk {
         using Self          = FileWrapper;
         using offset_type   = u32;
 
+        static constexpr bool MAPPED = false;
+
         std::fstream file;
+        std::string path;
+        std::mutex mutex;
 
         FileWrapper(): file() { }
         explicit FileWrapper(const char *filename) { open(filename); }
         explicit FileWrapper(const std::string &filename) { open(filename.c_str()); }
 
-        FileWrapper(Self &&other): file(std::move(other.file)) { }
+        FileWrapper(Self &&other): file(std::move(other.file)), path(std::move(other.path)) { }
         FileWrapper(const Self &) = delete;
 
         ~FileWrapper() { if (file.is_open()) file.close(); }
 
         auto open(const char *filename) -> bool {
+            path = filename;
             if (file.open(filename, std::ios::in | std::ios::out | std::ios::binary); file.is_open())
                 return true;
             return file.open(filename, "w+b"), false;
@@ -99,6 +655,9 @@ namespace HardDisk {
         auto is_open() const -> bool { return file.is_open(); }
         auto close() -> void { file.close(); }
         auto flush() -> void { file.flush(); }
+        /* fstream gives no way to reach the descriptor, this is as far as it goes */
+        auto sync() -> void { flush(); }
+        auto advise(access) -> void { }
 
         auto tell() const -> offset_type { return file.tellg(); }
         auto seek(offset_type offset) -> void {
@@ -125,11 +684,63 @@ namespace HardDisk {
             file.write(reinterpret_cast<char*>(std::addressof(obj)), sizeof(T));
         }
 
+        /* reads and writes that do not depend on the current position, these and append() may be
+         * called from several threads at once */
+        template <typename T>
+        auto read_at(offset_type offset, T &obj) -> void {
+            std::lock_guard guard(mutex);
+            seek(offset);
+            read(obj);
+        }
+
+        template <typename T>
+        auto write_at(offset_type offset, const T &obj) -> void {
+            std::lock_guard guard(mutex);
+            seek(offset);
+            write(obj);
+        }
+
+        auto read_bytes(offset_type offset, std::span<std::byte> bytes) -> size_t {
+            std::lock_guard guard(mutex);
+            seek(offset);
+            file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+            return file.gcount();
+        }
+
+        auto write_bytes(offset_type offset, std::span<const std::byte> bytes) -> void {
+            std::lock_guard guard(mutex);
+            seek(offset);
+            file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        }
+
+        /* one after the other, the stream has a single position */
+        auto read_batch(std::span<const read_request> requests) -> void {
+            for (const read_request &request: requests) read_bytes(request.offset, request.bytes);
+        }
+
+        auto size() -> offset_type {
+            std::lock_guard guard(mutex);
+            seek(-1);
+            return tell();
+        }
+
+        auto resize(offset_type bytes) -> void {
+            std::lock_guard guard(mutex);
+            flush();
+            std::filesystem::resize_file(path, bytes);
+        }
+
         template <typename T>
         auto append(const T &obj) -> offset_type {
+            constexpr offset_type alignment = file_alignment<T>();
+            std::lock_guard guard(mutex);
             seek(-1);
-            offset_type offset = tell();
+            offset_type offset = align_up(tell(), alignment);
+            seek(offset);
             write(obj);
+            /* the padding is written too, so that the next append starts past it */
+            if (offset_type pad = align_up(sizeof(T), alignment) - sizeof(T); pad > 0)
+                seek(offset + sizeof(T) + pad - 1), write(std::byte(0));
             return offset;
         }
     };
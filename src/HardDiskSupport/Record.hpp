@@ -9,6 +9,34 @@ using namespace __config;
 
 namespace HardDisk {
 
+    /* a type stored in another form than its bytes: ENCODED is set, and encode() writes it into
+     * FILE_BYTES bytes that decode() reads back */
+    template <typename T>
+    concept encoded = requires { requires T::ENCODED; };
+
+    /* the bytes of an encoded T as they are in the file */
+    template <typename T>
+    struct file_image {
+        static constexpr i64 FILE_ALIGNMENT = file_alignment<T>();
+        std::byte bytes[T::FILE_BYTES];
+    };
+
+    template <typename T>
+    constexpr auto file_bytes() -> size_t {
+        if constexpr (encoded<T>) return T::FILE_BYTES;
+        else return sizeof(T);
+    }
+
+    /* the bytes value is stored as, encoded into buffer if it has to be */
+    template <typename T>
+    auto image(const T &value, Vec<std::byte> &buffer) -> std::span<const std::byte> {
+        if constexpr (encoded<T>) {
+            buffer.resize(T::FILE_BYTES);
+            value.encode(buffer);
+            return buffer;
+        } else return std::as_bytes(std::span(std::addressof(value), 1));
+    }
+
     struct Record {
         using Self          = Record;
         using offset_type   = FileWrapper::offset_type;
@@ -40,36 +68,99 @@ namespace HardDisk {
 
         template <typename T>
         auto save(FileWrapper &io, const T &value) -> Self {
-            if (empty())
-                return Record(offset = io.append(value));
-            io.seek(offset);
-            io.write(value);
-            return *this;
+            if constexpr (encoded<T>) {
+                file_image<T> image;
+                value.encode(image.bytes);
+                return save(io, image);
+            } else {
+                if (empty())
+                    return Record(offset = io.append(value));
+                io.write_at(offset, value);
+                return *this;
+            }
         }
         template <typename T>
         auto load(FileWrapper &io, T &value) const -> Self {
             if (empty()) throw "try to load from an empty record";
-            io.seek(offset);
-            io.read(value);
+            if constexpr (encoded<T>) {
+                file_image<T> image;
+                io.read_at(offset, image);
+                value.decode(image.bytes);
+            } else io.read_at(offset, value);
             return *this;
         }
+        /* the stored object in place, only for a mapped file and a type stored as its bytes */
+        template <typename T, typename IO = FileWrapper>
+        auto view(const IO &io) const -> const T* requires (IO::MAPPED and not encoded<T>) {
+            if (empty()) throw "try to view an empty record";
+            return io.template view<T>(offset);
+        }
     };
 
+    /* free records of one type, ordered by offset so that a record can be reused close to where
+     * it is needed. the pool can be dumped to and restored from a file to survive a restart */
     template <typename T>
     struct RecordPool {
-        Vec<Record> recs;
+        using offset_type   = Record::offset_type;
+
+        std::set<offset_type> recs;
+        /* records released while holding, kept out of reach until release_held() */
+        std::set<offset_type> held;
+        bool holding;
+        std::mutex mutex;
 
-        RecordPool(): recs() {}
+        RecordPool(): recs(), held(), holding(false) {}
+
+        auto size() const -> size_t { return recs.size(); }
 
         auto alloc() -> Record {
+            std::lock_guard guard(mutex);
+            if (recs.empty()) return Record();
+            return Record(recs.extract(recs.begin()).value());
+        }
+
+        /* the free record nearest to hint */
+        auto alloc(const Record &hint) -> Record {
+            if (hint.empty()) return alloc();
+            std::lock_guard guard(mutex);
             if (recs.empty()) return Record();
-            Record tmp = recs.back();
-            recs.pop_back();
-            return tmp;
+            auto it = recs.lower_bound(hint.offset);
+            if (it == recs.end() or (it != recs.begin() and hint.offset - *std::prev(it) < *it - hint.offset)) --it;
+            return Record(recs.extract(it).value());
         }
 
         auto dealloc(const Record &rec) -> void {
-            recs.push_back(rec);
+            std::lock_guard guard(mutex);
+            (holding ? held : recs).insert(rec.offset);
+        }
+
+        /* while holding, released records are not handed out again, so whatever they contained
+         * stays on disk until release_held() */
+        auto hold(bool on) -> void {
+            holding = on;
+            if (not on) release_held();
+        }
+        auto release_held() -> void {
+            std::lock_guard guard(mutex);
+            recs.merge(held);
+        }
+
+        /* number of bytes dump() writes */
+        auto bytes() const -> size_t { return sizeof(u64) + recs.size() * sizeof(offset_type); }
+
+        auto dump(Vec<std::byte> &out) const -> void {
+            auto put = [&out](const auto &value) {
+                auto bytes = std::as_bytes(std::span(std::addressof(value), 1));
+                out.insert(out.end(), bytes.begin(), bytes.end());
+            };
+            put(u64(recs.size()));
+            for (offset_type offset: recs) put(offset);
+        }
+
+        auto restore(FileWrapper &io) -> void {
+            recs.clear();
+            for (u64 n = io.template read<u64>(); n > 0; --n)
+                recs.insert(recs.end(), io.template read<offset_type>());
         }
     };
 
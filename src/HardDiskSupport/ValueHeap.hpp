@@ -0,0 +1,304 @@
+#pragma once
+
+#include "config.hpp"
+#include "FileWrapper.hpp"
+#include "Record.hpp"
+#include "BufferPool.hpp"
+
+namespace __cpplib {
+
+using namespace __config;
+
+namespace HardDisk {
+
+    /* a value held as a run of trivially copyable elements of any length, std::string or
+     * std::vector<i32> say */
+    template <typename T>
+    concept byte_sequence = requires (T t, const T c, size_t n) {
+        { c.data() } -> std::convertible_to<const typename T::value_type*>;
+        { c.size() } -> std::convertible_to<size_t>;
+        t.resize(n);
+    } and std::is_trivially_copyable_v<typename T::value_type>;
+
+    template <byte_sequence T>
+    auto bytes_of(const T &value) -> std::span<const std::byte> { return std::as_bytes(std::span(value.data(), value.size())); }
+
+    template <byte_sequence T>
+    auto from_bytes(std::span<const std::byte> bytes) -> T {
+        T value;
+        value.resize(bytes.size() / sizeof(typename T::value_type));
+        if (not bytes.empty()) std::memcpy(value.data(), bytes.data(), value.size() * sizeof(typename T::value_type));
+        return value;
+    }
+
+    /* A page of values of varying length. The slot directory grows from the front of the page and
+     * the values from its back; a value keeps its slot for as long as it lives, so that it can be
+     * addressed by its page and slot index, while its bytes move whenever the page is compacted to
+     * close the holes erased values left behind. */
+    struct SlottedPage {
+        static constexpr size_t BYTES = 4096;
+        static constexpr i64 FILE_ALIGNMENT = BYTES;
+        /* tells the kinds of page apart, a reader holding a stale record finds out it is stale */
+        static constexpr u32 KIND = 0x534c4f54;
+
+        /* where in area a value starts and how long it is, offset 0 marks a free slot */
+        struct slot { u16 offset, length; };
+        static constexpr size_t AREA = BYTES - sizeof(u32) - 3 * sizeof(u16);
+
+        u32 kind;
+        /* slots in the directory, start of the values, bytes of erased values not yet reclaimed */
+        u16 count, top, garbage;
+        std::byte area[AREA];
+
+        SlottedPage(): kind(KIND), count(0), top(AREA), garbage(0), area() {}
+
+        auto entry(size_t i) const -> slot {
+            slot s;
+            std::memcpy(std::addressof(s), area + i * sizeof(slot), sizeof(slot));
+            return s;
+        }
+        auto set(size_t i, slot s) -> void { std::memcpy(area + i * sizeof(slot), std::addressof(s), sizeof(slot)); }
+
+        auto free_slot() const -> size_t {
+            size_t i = 0;
+            while (i < count and entry(i).offset != 0) ++i;
+            return i;
+        }
+
+        /* free bytes, counting the holes; a value needs its length and one slot's worth of them */
+        auto room() const -> size_t { return top - count * sizeof(slot) + garbage; }
+
+        auto holds(size_t i) const -> bool {
+            if (kind != KIND or i >= count or count * sizeof(slot) > top) return false;
+            slot s = entry(i);
+            return s.offset != 0 and s.offset + s.length <= AREA;
+        }
+        auto get(size_t i) const -> std::span<const std::byte> {
+            slot s = entry(i);
+            return { area + s.offset, s.length };
+        }
+
+        /* the index of the slot the value went to, it has to fit into room() */
+        auto put(std::span<const std::byte> value) -> size_t {
+            size_t i = free_slot(), front = (i == count ? count + 1 : count) * sizeof(slot);
+            if (front + value.size() > top) compact();
+            top -= value.size();
+            std::memcpy(area + top, value.data(), value.size());
+            if (i == count) ++count;
+            set(i, { top, u16(value.size()) });
+            return i;
+        }
+
+        auto erase(size_t i) -> void {
+            slot s = entry(i);
+            if (s.offset == top) top += s.length;
+            else garbage += s.length;
+            set(i, { 0, 0 });
+            while (count > 0 and entry(count - 1).offset == 0) --count;
+            if (count == 0) top = AREA, garbage = 0;
+        }
+
+        /* move the live values to the back of the page, in place */
+        auto compact() -> void {
+            if (garbage == 0) return;
+            Vec<std::pair<u16, size_t>> live;
+            for (size_t i = 0; i < count; ++i)
+                if (slot s = entry(i); s.offset != 0) live.emplace_back(s.offset, i);
+            /* going from the back, a value only ever moves towards it, past bytes already copied */
+            std::sort(live.begin(), live.end(), std::greater<>());
+            top = AREA;
+            for (auto [offset, i]: live) {
+                slot s = entry(i);
+                top -= s.length;
+                std::memmove(area + top, area + offset, s.length);
+                set(i, { top, s.length });
+            }
+            garbage = 0;
+        }
+    };
+
+    /* one page of a value too long for a SlottedPage, the value is spread over a chain of them */
+    struct OverflowPage {
+        static constexpr size_t BYTES = SlottedPage::BYTES;
+        static constexpr i64 FILE_ALIGNMENT = BYTES;
+        static constexpr u32 KIND = 0x4f564652;
+        static constexpr size_t AREA = BYTES - 2 * sizeof(u32) - sizeof(Record);
+
+        u32 kind;
+        /* bytes of the value held by the chain from this page on */
+        u32 bytes;
+        Record next;
+        std::byte area[AREA];
+
+        OverflowPage(): kind(KIND), bytes(0), next(), area() {}
+    };
+
+    /* Storage for values of varying length, addressed by records. Values up to LARGE_VALUE bytes
+     * share SlottedPages, which live in the BufferPool like the nodes do, and a record of one is the
+     * offset of its page with the slot index in the low bits. A longer value gets a chain of
+     * OverflowPages written straight to the file, its record is the offset of the first page
+     * marked with the CHAIN index. A value goes to the fullest page it fits into, so that pages
+     * stay dense. Thread-safe; the page room map and the free overflow pages are dumped and
+     * restored like the record pools. */
+    class ValueHeap {
+        using Self          = ValueHeap;
+        using offset_type   = Record::offset_type;
+
+    public:
+        static constexpr size_t PAGE_BYTES = SlottedPage::BYTES;
+        static constexpr size_t LARGE_VALUE = PAGE_BYTES / 4;
+
+    private:
+        static constexpr offset_type SLOT_MASK = PAGE_BYTES - 1;
+        static constexpr offset_type CHAIN = SLOT_MASK;
+
+        FileWrapper &io;
+        BufferPool &cache;
+        std::mutex mutex;
+        /* room() of every slotted page, and the same pairs ordered by room */
+        std::map<offset_type, u16> rooms;
+        std::set<std::pair<u16, offset_type>> byRoom;
+        /* pages of released chains, they are reused for either kind of page */
+        RecordPool<OverflowPage> freePages;
+
+        static auto need(std::span<const std::byte> value) -> size_t { return value.size() + sizeof(SlottedPage::slot); }
+
+        auto setRoom(offset_type page, size_t room) -> void {
+            if (auto it = rooms.find(page); it != rooms.end()) byRoom.erase({ it->second, page });
+            rooms[page] = room;
+            byRoom.emplace(room, page);
+        }
+
+        auto writeChain(std::span<const std::byte> value) -> Record {
+            auto page = std::make_unique<OverflowPage>();
+            Record next;
+            /* back to front, so that every page knows where the one after it went */
+            for (size_t n = (value.size() + OverflowPage::AREA - 1) / OverflowPage::AREA; n > 0; --n) {
+                size_t from = (n - 1) * OverflowPage::AREA, length = std::min(OverflowPage::AREA, value.size() - from);
+                page->bytes = value.size() - from;
+                page->next = next;
+                std::memcpy(page->area, value.data() + from, length);
+                next = freePages.alloc().save(io, *page);
+            } return Record(next.offset | CHAIN);
+        }
+
+        static auto readChain(FileWrapper &io, Record rec, Vec<std::byte> &out) -> bool {
+            auto page = std::make_unique<OverflowPage>();
+            rec.load(io, *page);
+            if (page->kind != OverflowPage::KIND) return false;
+            out.resize(page->bytes);
+            for (size_t at = 0; ; ) {
+                size_t length = std::min<size_t>(OverflowPage::AREA, page->bytes);
+                std::memcpy(out.data() + at, page->area, length);
+                if ((at += length) == out.size()) return true;
+                if (page->next.empty()) return false;
+                page->next.load(io, *page);
+                if (page->kind != OverflowPage::KIND or page->bytes != out.size() - at) return false;
+            }
+        }
+
+    public:
+        ValueHeap(FileWrapper &__io, BufferPool &__cache): io(__io), cache(__cache), mutex(), rooms(), byRoom(), freePages() {}
+        ValueHeap(const Self &) = delete;
+
+        static auto page_of(const Record &rec) -> Record { return Record(rec.offset & ~SLOT_MASK); }
+
+        auto put(std::span<const std::byte> value) -> Record {
+            std::lock_guard guard(mutex);
+            if (value.size() > LARGE_VALUE) return writeChain(value);
+            Record page;
+            BufferPool::handle<SlottedPage> u;
+            if (auto it = byRoom.lower_bound(std::pair<u16, offset_type>(need(value), 0)); it != byRoom.end())
+                page = Record(it->second), u = cache.template pin<SlottedPage>(page);
+            else page = freePages.alloc(), u = cache.template create<SlottedPage>(page);
+            size_t i = u->put(value);
+            u.dirty();
+            setRoom(page.offset, u->room());
+            return Record(page.offset | i);
+        }
+
+        /* the bytes of the value at rec; false if rec holds none, which happens to a reader that
+         * went by a record released under it */
+        auto get(const Record &rec, Vec<std::byte> &out) -> bool {
+            std::lock_guard guard(mutex);
+            if ((rec.offset & SLOT_MASK) == CHAIN) return readChain(io, page_of(rec), out);
+            if (rooms.find(page_of(rec).offset) == rooms.end()) return false;
+            auto u = cache.template pin<SlottedPage>(page_of(rec));
+            if (not u->holds(rec.offset & SLOT_MASK)) return false;
+            auto bytes = u->get(rec.offset & SLOT_MASK);
+            out.assign(bytes.begin(), bytes.end());
+            return true;
+        }
+
+        /* get() without the cache, through a file handle of the caller's own. nothing may have
+         * been left unwritten in the cache */
+        static auto read(FileWrapper &io, const Record &rec, Vec<std::byte> &out) -> bool {
+            if ((rec.offset & SLOT_MASK) == CHAIN) return readChain(io, page_of(rec), out);
+            auto u = std::make_unique<SlottedPage>();
+            page_of(rec).load(io, *u);
+            if (not u->holds(rec.offset & SLOT_MASK)) return false;
+            auto bytes = u->get(rec.offset & SLOT_MASK);
+            out.assign(bytes.begin(), bytes.end());
+            return true;
+        }
+
+        auto erase(const Record &rec) -> void {
+            std::lock_guard guard(mutex);
+            if ((rec.offset & SLOT_MASK) == CHAIN) {
+                auto page = std::make_unique<OverflowPage>();
+                for (Record at = page_of(rec); not at.empty(); at = page->next) {
+                    at.load(io, *page);
+                    freePages.dealloc(at);
+                }
+            } else {
+                auto u = cache.template pin<SlottedPage>(page_of(rec));
+                u->erase(rec.offset & SLOT_MASK);
+                u.dirty();
+                setRoom(page_of(rec).offset, u->room());
+            }
+        }
+
+        /* store value in place of the one at rec, in the same page while it fits there */
+        auto replace(Record &rec, std::span<const std::byte> value) -> void {
+            if ((rec.offset & SLOT_MASK) != CHAIN and value.size() <= LARGE_VALUE) {
+                std::lock_guard guard(mutex);
+                auto u = cache.template pin<SlottedPage>(page_of(rec));
+                u->erase(rec.offset & SLOT_MASK);
+                if (need(value) <= u->room()) {
+                    rec = Record(page_of(rec).offset | u->put(value));
+                    u.dirty();
+                    setRoom(page_of(rec).offset, u->room());
+                    return;
+                }
+                u.dirty();
+                setRoom(page_of(rec).offset, u->room());
+            } else erase(rec);
+            rec = put(value);
+        }
+
+        /* number of bytes dump() writes */
+        auto bytes() const -> size_t { return sizeof(u64) + rooms.size() * (sizeof(offset_type) + sizeof(u16)) + freePages.bytes(); }
+
+        auto dump(Vec<std::byte> &out) const -> void {
+            auto put = [&out](const auto &value) {
+                auto bytes = std::as_bytes(std::span(std::addressof(value), 1));
+                out.insert(out.end(), bytes.begin(), bytes.end());
+            };
+            put(u64(rooms.size()));
+            for (auto [page, room]: rooms) put(page), put(room);
+            freePages.dump(out);
+        }
+
+        auto restore(FileWrapper &file) -> void {
+            rooms.clear(), byRoom.clear();
+            for (u64 n = file.template read<u64>(); n > 0; --n) {
+                offset_type page = file.template read<offset_type>();
+                setRoom(page, file.template read<u16>());
+            }
+            freePages.restore(file);
+        }
+    };
+
+}
+
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "config.hpp"
+#include "FileWrapper.hpp"
+
+namespace __cpplib {
+
+using namespace __config;
+
+namespace HardDisk {
+
+    /* An append-only redo log kept next to a data file. It holds two kinds of entries: records,
+     * opaque payloads the owner replays after a crash, and images, raw bytes destined for an
+     * offset of the data file. A checkpoint logs the images of everything it is about to write
+     * in place and seals them; once the seal is on disk the in-place writes may start, and when
+     * they are done the log is truncated. On open, replay() hands back either the sealed images
+     * of an interrupted checkpoint, or the records written since the last one.
+     *
+     * Appends only copy into a buffer. A commit makes its entries durable according to the sync
+     * policy, and threads committing at the same time share one fsync (group commit). */
+    struct WriteAheadLog {
+        using Self          = WriteAheadLog;
+        using offset_type   = FileWrapper::offset_type;
+        using lsn_type      = u64;
+
+        struct sync_policy {
+            enum kind_t: u8 { per_op, interval, volume } kind;
+            u64 amount;
+
+            /* every commit waits for its entries to be on disk */
+            static constexpr auto every_op() -> sync_policy { return { per_op, 0 }; }
+            /* a background thread syncs every ms milliseconds, commits do not wait */
+            static constexpr auto every_ms(u64 ms) -> sync_policy { return { interval, ms }; }
+            /* the log is synced whenever bytes unsynced bytes have piled up, commits do not wait */
+            static constexpr auto every_bytes(u64 bytes) -> sync_policy { return { volume, bytes }; }
+        };
+
+    private:
+        enum entry_type: u32 { record = 1, image = 2, seal = 3 };
+
+        struct entry_header {
+            u32 bytes;
+            u32 type;
+            u32 checksum;
+        };
+
+        FileWrapper io;
+        sync_policy policy;
+
+        std::mutex mutex;
+        std::condition_variable cond;
+        Vec<std::byte> buffer;
+        /* log offsets: everything before appended has been appended, before durable synced */
+        lsn_type appended, durable;
+        bool syncing, stopping;
+        std::thread ticker;
+
+        static auto checksum(u32 type, std::span<const std::byte> payload) -> u32 {
+            u32 hash = 2166136261u ^ type;
+            for (std::byte b: payload) hash = (hash ^ u32(b)) * 16777619u;
+            return hash;
+        }
+
+        /* frame an entry into the buffer, mutex must be held */
+        auto put(entry_type type, std::span<const std::byte> head, std::span<const std::byte> payload) -> lsn_type {
+            entry_header header{ u32(head.size() + payload.size()), type, 0 };
+            u32 hash = 2166136261u ^ type;
+            for (auto part: { head, payload })
+                for (std::byte b: part) hash = (hash ^ u32(b)) * 16777619u;
+            header.checksum = hash;
+            auto bytes = std::as_bytes(std::span(std::addressof(header), 1));
+            buffer.insert(buffer.end(), bytes.begin(), bytes.end());
+            buffer.insert(buffer.end(), head.begin(), head.end());
+            buffer.insert(buffer.end(), payload.begin(), payload.end());
+            return appended += sizeof(entry_header) + head.size() + payload.size();
+        }
+
+        /* make everything before lsn durable, either by leading a sync or by waiting for the
+         * one in progress; whoever leads writes out all that has been appended so far */
+        auto sync_to(std::unique_lock<std::mutex> &lock, lsn_type lsn) -> void {
+            while (durable < lsn) {
+                if (syncing) { cond.wait(lock); continue; }
+                syncing = true;
+                Vec<std::byte> out;
+                out.swap(buffer);
+                lsn_type from = appended - out.size(), to = appended;
+                lock.unlock();
+                io.write_bytes(from, out);
+                io.sync();
+                lock.lock();
+                durable = to;
+                syncing = false;
+                cond.notify_all();
+            }
+        }
+
+        auto tick() -> void {
+            std::unique_lock lock(mutex);
+            while (not stopping) {
+                cond.wait_for(lock, std::chrono::milliseconds(policy.amount));
+                if (durable < appended) sync_to(lock, appended);
+            }
+        }
+
+    public:
+        explicit WriteAheadLog(const std::string &filename, sync_policy __policy = sync_policy::every_op())
+            : io(), policy(__policy), buffer(), syncing(false), stopping(false) {
+            io.open(filename);
+            appended = durable = io.size();
+            if (policy.kind == sync_policy::interval)
+                ticker = std::thread(&Self::tick, this);
+        }
+        WriteAheadLog(const Self &) = delete;
+
+        ~WriteAheadLog() {
+            {
+                std::unique_lock lock(mutex);
+                stopping = true;
+                sync_to(lock, appended);
+            }
+            cond.notify_all();
+            if (ticker.joinable()) ticker.join();
+        }
+
+        auto size() -> lsn_type { std::lock_guard guard(mutex); return appended; }
+
+        auto append(std::span<const std::byte> payload) -> lsn_type {
+            std::unique_lock lock(mutex);
+            lsn_type lsn = put(record, {}, payload);
+            if (policy.kind == sync_policy::volume and appended - durable >= policy.amount)
+                sync_to(lock, lsn);
+            return lsn;
+        }
+
+        /* the entries up to lsn are durable as far as the sync policy promises */
+        auto commit(lsn_type lsn) -> void {
+            if (policy.kind != sync_policy::per_op) return;
+            std::unique_lock lock(mutex);
+            sync_to(lock, lsn);
+        }
+
+        auto sync() -> void {
+            std::unique_lock lock(mutex);
+            sync_to(lock, appended);
+        }
+
+        /* checkpoint: log bytes to be written at offset of the data file */
+        auto log_image(offset_type offset, std::span<const std::byte> bytes) -> void {
+            std::lock_guard guard(mutex);
+            put(image, std::as_bytes(std::span(std::addressof(offset), 1)), bytes);
+        }
+
+        /* checkpoint: the images logged so far are complete, returns once that is durable */
+        auto log_seal() -> void {
+            std::unique_lock lock(mutex);
+            sync_to(lock, put(seal, {}, {}));
+        }
+
+        /* checkpoint: the data file has everything, drop the log */
+        auto truncate() -> void {
+            std::unique_lock lock(mutex);
+            sync_to(lock, appended);
+            io.resize(0);
+            appended = durable = 0;
+        }
+
+        /* walk the intact prefix of the log. if it ends in a sealed checkpoint, on_image(offset,
+         * bytes) is called for each of its images and true returned, otherwise on_record(payload)
+         * is called for each record. a torn tail is cut off */
+        template <typename OnImage, typename OnRecord>
+        auto replay(OnImage &&on_image, OnRecord &&on_record) -> bool {
+            std::lock_guard guard(mutex);
+            Vec<std::byte> log(appended);
+            log.resize(io.read_bytes(0, log));
+
+            struct entry { entry_type type; std::span<const std::byte> payload; };
+            Vec<entry> entries;
+            bool sealed = false;
+            size_t pos = 0, images = log.size();
+            for (entry_header header; pos + sizeof(header) <= log.size(); ) {
+                std::memcpy(std::addressof(header), log.data() + pos, sizeof(header));
+                if (header.bytes > log.size() - pos - sizeof(header)) break;
+                std::span<const std::byte> payload(log.data() + pos + sizeof(header), header.bytes);
+                if (header.checksum != checksum(header.type, payload)) break;
+                if (header.type == seal) sealed = true;
+                if (header.type == image) images = std::min(images, pos);
+                entries.push_back({ entry_type(header.type), payload });
+                pos += sizeof(header) + header.bytes;
+            }
+            /* the images of a checkpoint that never got sealed must not be mistaken for part of
+             * the next one */
+            if (not sealed) pos = std::min(pos, images);
+            if (pos < log.size()) {
+                io.resize(pos);
+                appended = durable = pos;
+            }
+
+            for (const entry &e: entries) {
+                if (sealed and e.type == image) {
+                    offset_type offset;
+                    std::memcpy(std::addressof(offset), e.payload.data(), sizeof(offset));
+                    on_image(offset, e.payload.subspan(sizeof(offset)));
+                } else if (not sealed and e.type == record)
+                    on_record(e.payload);
+            }
+            return sealed;
+        }
+    };
+
+}
+
+}
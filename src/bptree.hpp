@@ -4,12 +4,164 @@
 #include "config.hpp"
 #include "HardDiskSupport/FileWrapper.hpp"
 #include "HardDiskSupport/Record.hpp"
+#include "HardDiskSupport/BufferPool.hpp"
+#include "HardDiskSupport/WriteAheadLog.hpp"
+#include "HardDiskSupport/BloomFilter.hpp"
+#include "HardDiskSupport/ValueHeap.hpp"
 
 namespace __cpplib {
 
 using namespace __config;
 
-template <typename Key, typename Value, typename Compare = std::less<Key>, i32 FACTOR = 100>
+/* the position of the first of n sorted keys not less than (lower) or greater than (upper) key,
+ * as std::lower_bound and std::upper_bound return it */
+template <typename Key, typename Compare, bool VECTOR = true>
+struct key_search {
+    static auto lower(const Key *keys, size_t n, const Key &key, const Compare &comp) -> size_t { return std::lower_bound(keys, keys + n, key, comp) - keys; }
+    static auto upper(const Key *keys, size_t n, const Key &key, const Compare &comp) -> size_t { return std::upper_bound(keys, keys + n, key, comp) - keys; }
+};
+
+template <typename Key, typename Compare>
+concept vector_searchable = (std::is_integral_v<Key> or std::is_floating_point_v<Key>) and not std::is_same_v<Key, bool>
+    and (sizeof(Key) == 1 or sizeof(Key) == 2 or sizeof(Key) == 4 or sizeof(Key) == 8)
+    and (std::is_same_v<Compare, std::less<Key>> or std::is_same_v<Compare, std::less<>>);
+
+/* arithmetic keys under std::less: branch-free halving down to a few vectors worth of keys, then
+ * the keys before the bound among those are counted with vector compares, which come out as AVX2
+ * or SSE where the target has them and as plain code elsewhere */
+template <typename Key, typename Compare> requires vector_searchable<Key, Compare>
+struct key_search<Key, Compare, true> {
+#if defined(__AVX2__)
+    static constexpr size_t VECTOR_BYTES = 32;
+#else
+    static constexpr size_t VECTOR_BYTES = 16;
+#endif
+    static constexpr size_t LANES = VECTOR_BYTES / sizeof(Key);
+    static constexpr size_t WINDOW = 4 * LANES;
+
+    static auto lower(const Key *keys, size_t n, const Key &key, const Compare &) -> size_t { return search<false>(keys, n, key); }
+    static auto upper(const Key *keys, size_t n, const Key &key, const Compare &) -> size_t { return search<true>(keys, n, key); }
+
+private:
+    /* whether x goes before the bound */
+    template <bool UPPER>
+    static auto before(Key x, Key key) -> bool { return UPPER ? not (key < x) : x < key; }
+
+    template <bool UPPER>
+    static auto search(const Key *keys, size_t n, Key key) -> size_t {
+        const Key *base = keys;
+        while (n > WINDOW) {
+            size_t half = n / 2;
+            base = before<UPPER>(base[half - 1], key) ? base + half : base;
+            n -= half;
+        } return (base - keys) + count<UPPER>(base, n, key);
+    }
+
+    /* how many of the n keys go before the bound, n is at most WINDOW */
+    template <bool UPPER>
+    static auto count(const Key *keys, size_t n, Key key) -> size_t {
+        size_t i = 0, found = 0;
+#if defined(__GNUC__)
+        typedef Key vector __attribute__((vector_size(VECTOR_BYTES)));
+        using mask = decltype(vector() < vector());
+        vector bound = vector() + key;
+        mask hits = mask();
+        for ( ; i + LANES <= n; i += LANES) {
+            vector v;
+            std::memcpy(&v, keys + i, sizeof(v));
+            if constexpr (UPPER) hits -= ~(bound < v);
+            else hits -= v < bound;
+        }
+        for (size_t lane = 0; lane < LANES; ++lane) found += hits[lane];
+#endif
+        for ( ; i < n; ++i) found += before<UPPER>(keys[i], key);
+        return found;
+    }
+};
+
+/* a string of at most N bytes, none of them zero, to be used as a Key. it is zero padded and
+ * ordered bytewise, so that with PREFIX_COMPRESSION only the bytes it uses go to disk */
+template <size_t N>
+struct key_string {
+    char s[N];
+
+    key_string(): s() {}
+    key_string(std::string_view str): s() {
+        if (str.size() > N) throw "in key_string: string too long";
+        std::memcpy(s, str.data(), str.size());
+    }
+
+    auto view() const -> std::string_view { return { s, ::strnlen(s, N) }; }
+
+    auto operator <=> (const key_string &rhs) const -> std::strong_ordering { return std::memcmp(s, rhs.s, N) <=> 0; }
+    auto operator == (const key_string &rhs) const -> bool { return std::memcmp(s, rhs.s, N) == 0; }
+};
+
+/* monoids for bptree_traits::AGGREGATE: value_type is what a range folds into, identity() what an
+ * empty one does, of() what a single key and value do and combine() joins two adjacent ranges.
+ * derive from one and override of() to fold something else than the values */
+template <typename Key, typename Value, typename T = Value>
+struct sum_aggregate {
+    using value_type = T;
+    static auto identity() -> T { return T(); }
+    static auto of(const Key &, const Value &value) -> T { return T(value); }
+    static auto combine(const T &lhs, const T &rhs) -> T { return lhs + rhs; }
+};
+template <typename Key, typename Value, typename T = Value>
+struct min_aggregate {
+    using value_type = T;
+    static auto identity() -> T { return std::numeric_limits<T>::max(); }
+    static auto of(const Key &, const Value &value) -> T { return T(value); }
+    static auto combine(const T &lhs, const T &rhs) -> T { return std::min(lhs, rhs); }
+};
+template <typename Key, typename Value, typename T = Value>
+struct max_aggregate {
+    using value_type = T;
+    static auto identity() -> T { return std::numeric_limits<T>::lowest(); }
+    static auto of(const Key &, const Value &value) -> T { return T(value); }
+    static auto combine(const T &lhs, const T &rhs) -> T { return std::max(lhs, rhs); }
+};
+
+/* compile-time settings of bptree, derive from it and override a member to change one */
+template <typename Key, typename Value>
+struct bptree_traits {
+    /* trivially copyable values no larger than this are stored in the leaves themselves */
+    static constexpr size_t INLINE_VALUE_SIZE = 128;
+    /* allow insert, erase, find, value and lower_bound to be called from several threads at once */
+    static constexpr bool CONCURRENT = false;
+    /* keep a redo log next to the file so that committed writes survive a crash, and how
+     * eagerly it is synced */
+    static constexpr bool WRITE_AHEAD_LOG = false;
+    static constexpr HardDisk::WriteAheadLog::sync_policy LOG_SYNC = HardDisk::WriteAheadLog::sync_policy::every_op();
+    /* when non-zero, FACTOR is ignored: the fanouts are chosen so that a node fills one page of
+     * this many bytes, and every node starts on a page of its own in the file */
+    static constexpr size_t PAGE_BYTES = 0;
+    /* search the keys of a node with vector compares where key_search has a way to */
+    static constexpr bool VECTOR_SEARCH = true;
+    /* when non-zero, keep a Bloom filter of this many bits per key over std::hash of the keys,
+     * so that find(), value() and multi_get() of absent keys mostly skip the tree */
+    static constexpr size_t BLOOM_BITS_PER_KEY = 0;
+    /* store the keys of a node with the prefix they share cut off, and the separators in internal
+     * nodes cut short, so that more of them fit into a page. needs PAGE_BYTES and a trivially
+     * copyable Key; separators only come out short when the bytes of the keys order like Compare */
+    static constexpr bool PREFIX_COMPRESSION = false;
+    /* when non-zero, every internal node holds up to this many writes for its subtree, and passes
+     * them on towards the leaves in bulk once it has more, see post(). value() takes the held
+     * writes into account on the way down; find() and insert() first take the ones for their key
+     * down to the leaf and lower_bound(), scan() and rscan() all of them, so an iterator only sees
+     * its neighbours as they are after those. needs trivially copyable Key and Value */
+    static constexpr size_t MESSAGE_BUFFER = 0;
+    /* keep the number of keys under every child of an internal node, for size(), rank(), nth(),
+     * count() and iterators that jump over many keys in a logarithmic number of node reads. has to
+     * be set when the file is created */
+    static constexpr bool ORDER_STATISTICS = false;
+    /* when not void, a monoid kept over the keys and values under every child of an internal node,
+     * so that aggregate() folds a range in a logarithmic number of node reads, see sum_aggregate.
+     * needs inlined values, and has to be set when the file is created */
+    using AGGREGATE = void;
+};
+
+template <typename Key, typename Value, typename Compare = std::less<Key>, i32 FACTOR = 100, typename Traits = bptree_traits<Key, Value>>
 class bptree {
     // static_assert(std::is_trivially_copyable_v<Key>, "template argument Key is not trivially copyable");
     // static_assert(std::is_trivially_copyable_v<Value>, "template argument Value is not trivially copyable");
@@ -18,6 +170,9 @@ class bptree {
 
     using Self              = bptree;
 
+    /* stands in for AGGREGATE when there is none */
+    struct no_aggregate { using value_type = std::monostate; };
+
 public:
     using key_type          = Key;
     using value_type        = Value;
@@ -25,94 +180,451 @@ public:
     using size_type         = size_t;
     using difference_type   = ::std::ptrdiff_t;
 
+    static constexpr bool INLINE_VALUE = std::is_trivially_copyable_v<Value> and sizeof(Value) <= Traits::INLINE_VALUE_SIZE;
+    /* values of a byte_sequence type (std::string, std::vector) are stored with their length, in
+     * pages of the value heap shared among values */
+    static constexpr bool VARIABLE_VALUE = HardDisk::byte_sequence<Value>;
+    static constexpr bool CONCURRENT = Traits::CONCURRENT;
+    static constexpr bool LOGGED = Traits::WRITE_AHEAD_LOG;
+    /* in write-optimized mode the writes of post() settle in the internal nodes on their way down */
+    static constexpr size_type MESSAGE_BUFFER = Traits::MESSAGE_BUFFER;
+    static constexpr bool BUFFERED = MESSAGE_BUFFER > 0;
+    static constexpr bool COUNTED = Traits::ORDER_STATISTICS;
+    static constexpr bool AGGREGATED = not std::is_void_v<typename Traits::AGGREGATE>;
+    using aggregate_monoid  = std::conditional_t<AGGREGATED, typename Traits::AGGREGATE, no_aggregate>;
+    using aggregate_type    = typename aggregate_monoid::value_type;
+    /* keys that descend together in multi_get */
+    static constexpr size_type MULTI_GET_BATCH = 1024;
+
+    /* readers look at nodes that may be written to under them and throw away what they saw if
+     * the node changed, which is only harmless for plain keys */
+    static_assert(not CONCURRENT or std::is_trivially_copyable_v<Key>, "concurrent bptree requires a trivially copyable Key");
+    static_assert(not LOGGED or (std::is_trivially_copyable_v<Key> and std::is_trivially_copyable_v<Value>), "logged bptree requires trivially copyable Key and Value");
+
     class iterator;
+    class cursor;
+
+    /* a single write of a batch, see apply_batch() */
+    struct op {
+        enum type_t: u8 { insert, upsert, erase } type;
+        key_type key;
+        value_type value;
+    };
 
 private:
     struct leaf_node;
     struct internal_node;
 
+    /* the writes an internal node holds for its subtree in write-optimized mode, sorted by key and
+     * one per key. a node takes in up to MESSAGE_BUFFER of them; merging and evening out nodes may
+     * leave it with up to twice as many */
+    struct message_buffer {
+        size_type   pending = 0;
+        op          message[2 * MESSAGE_BUFFER];
+    };
+    struct no_message_buffer {};
+
     struct header_type {
         HardDisk::Record root;
+        /* region holding the free lists of the record pools, rewritten by flush() */
+        HardDisk::Record freeSpace;
+        size_type freeSpaceBytes = 0;
+        /* region holding the Bloom filter, rewritten by flush() the same way */
+        HardDisk::Record filterSpace;
+        size_type filterSpaceBytes = 0;
     } header;
 
     key_compare key_le;
     auto key_eq(const key_type &lhs, const key_type &rhs) const -> bool { return not (key_le(lhs, rhs) or key_le(rhs, lhs)); }
+    /* std::lower_bound and std::upper_bound over the first n keys of a node, as positions */
+    using search_type = key_search<key_type, key_compare, Traits::VECTOR_SEARCH>;
+    auto key_lower(const key_type *keys, size_type n, const key_type &key) const -> size_type { return search_type::lower(keys, n, key, key_le); }
+    auto key_upper(const key_type *keys, size_type n, const key_type &key) const -> size_type { return search_type::upper(keys, n, key, key_le); }
+
+    /* every key in the tree is in the filter. it grows by being rebuilt from the leaves, at
+     * flush() and, unless the tree is concurrent, after a write that left it stale */
+    static constexpr bool FILTERED = Traits::BLOOM_BITS_PER_KEY > 0;
+    HardDisk::BloomFilter filter;
+
+    auto filterAdd(const key_type &key) -> void { if constexpr (FILTERED) filter.insert(std::hash<key_type>()(key)); }
+    auto filterErase() -> void { if constexpr (FILTERED) filter.note_erase(); }
+    auto absent(const key_type &key) const -> bool {
+        if constexpr (FILTERED) return not filter.may_contain(std::hash<key_type>()(key));
+        else return false;
+    }
+    auto tendFilter() -> void;
 
+    std::string fileName;
     HardDisk::FileWrapper file;
+    HardDisk::BufferPool nodeCache;
     HardDisk::RecordPool<value_type> dataPool;
+    HardDisk::ValueHeap valueHeap;
     HardDisk::RecordPool<leaf_node> leafNodePool;
     HardDisk::RecordPool<internal_node> internalNodePool;
     internal_node *root;
+    /* the rightmost leaf as of the last insert that reached it, see insert(). keys past its last
+     * one go straight to it */
+    HardDisk::Record lastLeaf;
+
+    /* in concurrent mode every node is guarded by the latch of its cache frame, and the root by
+     * rootLatch. lookups descend optimistically and start over when a node they passed changed,
+     * writes that stay within one leaf latch only that leaf, and writes that split or merge nodes
+     * are serialised by structureLock and latch every node they pin */
+    HardDisk::Latch rootLatch;
+    std::mutex structureLock;
+
+    template <typename T>
+    auto pinNode(const HardDisk::Record &rec) -> HardDisk::BufferPool::handle<T> { return nodeCache.template pin<T>(rec, CONCURRENT); }
+    template <typename T>
+    auto createNode(HardDisk::Record &rec) -> HardDisk::BufferPool::handle<T> { return nodeCache.template create<T>(rec, CONCURRENT); }
+    auto exclusive() -> std::pair<std::unique_lock<std::mutex>, std::unique_lock<HardDisk::Latch>>;
+    auto descend(const key_type &key) -> std::tuple<HardDisk::BufferPool::handle<leaf_node>, HardDisk::Record, u64>;
+
+    /* in logged mode the file only ever holds the state of the last checkpoint: dirty nodes stay
+     * in the cache, released records are not reused and the header is not rewritten until the
+     * next flush(). every write is logged as an op, while its nodes are still latched so that the
+     * log order is the order the writes took effect in, and committed once they are released */
+    std::unique_ptr<HardDisk::WriteAheadLog> wal;
+    std::shared_mutex checkpointLock;
+
+    auto writing() -> std::shared_lock<std::shared_mutex>;
+    auto logOp(typename op::type_t type, const key_type &key, const value_type &value) -> u64;
+    auto commit(u64 lsn) -> void;
+
+    /* what a leaf keeps for each key: the bytes of the value if it is inlined, its record otherwise.
+     * the bytes are kept raw so that a leaf never default constructs a value */
+    struct value_bytes {
+        alignas(value_type) std::byte bytes[sizeof(value_type)];
+    };
+    using slot_type = std::conditional_t<INLINE_VALUE, value_bytes, HardDisk::Record>;
+
+    static constexpr size_type PAGE_BYTES = Traits::PAGE_BYTES;
+    static constexpr size_type NODE_ALIGNMENT = PAGE_BYTES > 0 ? PAGE_BYTES : 1;
+
+    static constexpr auto alignUp(size_type bytes, size_type align) -> size_type { return (bytes + align - 1) / align * align; }
+    /* the size of a node of head bytes of fields followed by n Firsts and n + extra Seconds, laid
+     * out the way leaf_node and internal_node are */
+    template <typename First, typename Second>
+    static constexpr auto nodeBytes(size_type head, size_type n, size_type extra) -> size_type {
+        size_type at = alignUp(head, alignof(First)) + n * sizeof(First);
+        at = alignUp(at, alignof(Second)) + (n + extra) * sizeof(Second);
+        return alignUp(at, std::max({ alignof(size_type), alignof(HardDisk::Record), alignof(First), alignof(Second) }));
+    }
+    template <typename First, typename Second>
+    static constexpr auto pageFactor(size_type head, size_type extra) -> i32 {
+        i32 n = 0;
+        while (nodeBytes<First, Second>(head, n + 1, extra) <= PAGE_BYTES) ++n;
+        return n;
+    }
+
+    /* a compressed node is stored as its header fields, its keys as putKeys() writes them, then
+     * the slots or children */
+    static constexpr bool COMPRESSED = Traits::PREFIX_COMPRESSION;
+    static_assert(not COMPRESSED or (PAGE_BYTES > 0 and std::is_trivially_copyable_v<key_type>), "PREFIX_COMPRESSION of bptree needs PAGE_BYTES and a trivially copyable Key");
+    /* held writes are stored raw in the nodes and are invisible to a filter built from the leaves */
+    static_assert(not BUFFERED or (std::is_trivially_copyable_v<key_type> and std::is_trivially_copyable_v<value_type> and not CONCURRENT and not COMPRESSED and not FILTERED),
+        "MESSAGE_BUFFER of bptree needs trivially copyable Key and Value, and rules out CONCURRENT, PREFIX_COMPRESSION and BLOOM_BITS_PER_KEY");
+    /* a write within a leaf changes the count of every node above it */
+    static_assert(not COUNTED or not (CONCURRENT or BUFFERED), "ORDER_STATISTICS of bptree rules out CONCURRENT and MESSAGE_BUFFER");
+    /* the same goes for the summaries, which are also taken from the values in the leaves */
+    static_assert(not AGGREGATED or (INLINE_VALUE and std::is_trivially_copyable_v<aggregate_type> and not (CONCURRENT or BUFFERED)),
+        "AGGREGATE of bptree needs inlined values and a trivially copyable value_type, and rules out CONCURRENT and MESSAGE_BUFFER");
+    /* what an internal node keeps of the keys under each of its children: their number, see
+     * ORDER_STATISTICS, and what AGGREGATE folds them into */
+    struct tally_type {
+        [[no_unique_address]] std::conditional_t<COUNTED, size_type, std::monostate> count;
+        [[no_unique_address]] aggregate_type summary;
+    };
+    static constexpr bool TALLIED = COUNTED or AGGREGATED;
+    static constexpr size_type MESSAGE_BYTES = BUFFERED ? alignUp(alignUp(sizeof(size_type), alignof(op)) + 2 * MESSAGE_BUFFER * sizeof(op), std::max(alignof(size_type), alignof(op))) : 0;
+    using length_type = std::conditional_t<(sizeof(key_type) < 256), u8, u16>;
+    static constexpr size_type KEY_BYTES = sizeof(key_type);
+    static constexpr size_type LEAF_HEAD = sizeof(size_type) + 2 * sizeof(HardDisk::Record);
+    static constexpr size_type TALLY_BYTES = TALLIED ? sizeof(tally_type) : 0;
+    static constexpr size_type INTERNAL_HEAD = sizeof(u8) + sizeof(size_type) + sizeof(HardDisk::Record) + TALLY_BYTES;
+    static constexpr auto encodedFactor(size_type head, size_type entry) -> i32 {
+        i32 n = 0;
+        while (head + (n + 1) * entry <= PAGE_BYTES) ++n;
+        return n + 1;
+    }
+    /* in memory, a compressed node has room for this many times the keys of one whose keys do not
+     * compress at all */
+    static constexpr i32 COMPRESSED_SCALE = 4;
+
+    /* the fanouts of nodes whose keys do not compress, and the ones they are sized for in memory */
+    static constexpr i32 LEAF_BASE = COMPRESSED ? encodedFactor(LEAF_HEAD + sizeof(u16), sizeof(length_type) + KEY_BYTES + sizeof(slot_type))
+        : PAGE_BYTES == 0 ? FACTOR : pageFactor<key_type, slot_type>(sizeof(size_type) + 2 * sizeof(HardDisk::Record), 0);
+    /* a child of an internal node together with its tally, only to size nodes by */
+    struct tallied_sub {
+        HardDisk::Record    sub;
+        tally_type          tally;
+    };
+    static constexpr i32 INTERNAL_BASE = COMPRESSED ? encodedFactor(INTERNAL_HEAD + sizeof(u16), sizeof(length_type) + KEY_BYTES + sizeof(HardDisk::Record) + TALLY_BYTES)
+        : PAGE_BYTES == 0 ? FACTOR : pageFactor<key_type, std::conditional_t<TALLIED, tallied_sub, HardDisk::Record>>(alignUp(MESSAGE_BYTES + sizeof(bool), alignof(size_type)) + sizeof(size_type), 1);
+    static constexpr i32 LEAF_FACTOR = COMPRESSED ? COMPRESSED_SCALE * LEAF_BASE : LEAF_BASE;
+    static constexpr i32 INTERNAL_FACTOR = COMPRESSED ? COMPRESSED_SCALE * INTERNAL_BASE : INTERNAL_BASE;
+    static_assert(LEAF_BASE > 10 and INTERNAL_BASE > 10, "PAGE_BYTES of bptree too small for its Key and Value");
+
+    struct subtree_tallies {
+        tally_type  tally[INTERNAL_FACTOR + 1] = {};
+    };
+    struct no_subtree_tallies {};
+
+    static auto keyBytes(const key_type &key) -> const std::byte* { return reinterpret_cast<const std::byte*>(std::addressof(key)); }
+    /* the length of the prefix all n keys share */
+    static auto sharedPrefix(const key_type *keys, size_type n) -> size_type {
+        if (n == 0) return 0;
+        const std::byte *first = keyBytes(keys[0]);
+        size_type p = KEY_BYTES;
+        for (size_type i = n - 1; i > 0 and p > 0; --i)
+            if (std::memcmp(first, keyBytes(keys[i]), p) != 0)
+                p = std::mismatch(first, first + p, keyBytes(keys[i])).first - first;
+        return p;
+    }
+    /* the length of key without its trailing zero bytes */
+    static auto usedBytes(const key_type &key) -> size_type {
+        size_type n = KEY_BYTES;
+        for (u64 word; n >= sizeof(word) and (std::memcpy(&word, keyBytes(key) + n - sizeof(word), sizeof(word)), word == 0); ) n -= sizeof(word);
+        while (n > 0 and keyBytes(key)[n - 1] == std::byte(0)) --n;
+        return n;
+    }
+    /* the bytes putKeys() takes for n keys sharing a prefix of length p */
+    static auto keysBytes(const key_type *keys, size_type n, size_type p) -> size_type {
+        size_type bytes = sizeof(u16) + p + n * sizeof(length_type);
+        for (size_type i = 0; i < n; ++i) bytes += std::max(usedBytes(keys[i]), p) - p;
+        return bytes;
+    }
+    static auto putBytes(std::span<std::byte> &out, const void *from, size_type bytes) -> void {
+        if (bytes > out.size()) throw "in bptree: node does not fit into its page";
+        std::memcpy(out.data(), from, bytes), out = out.subspan(bytes);
+    }
+    static auto getBytes(std::span<const std::byte> &in, void *to, size_type bytes) -> void {
+        std::memcpy(to, in.data(), bytes), in = in.subspan(bytes);
+    }
+    /* the length of the shared prefix and the prefix, then every key without it and without its
+     * trailing zero bytes, after its length */
+    static auto putKeys(std::span<std::byte> &out, const key_type *keys, size_type n) -> void {
+        u16 p = sharedPrefix(keys, n);
+        putBytes(out, &p, sizeof(p));
+        if (n > 0) putBytes(out, keyBytes(keys[0]), p);
+        for (size_type i = 0; i < n; ++i) {
+            length_type used = std::max<size_type>(usedBytes(keys[i]), p) - p;
+            putBytes(out, &used, sizeof(used)), putBytes(out, keyBytes(keys[i]) + p, used);
+        }
+    }
+    static auto getKeys(std::span<const std::byte> &in, key_type *keys, size_type n) -> void {
+        u16 p;
+        getBytes(in, &p, sizeof(p));
+        std::span<const std::byte> prefix = in.first(p);
+        in = in.subspan(p);
+        for (size_type i = 0; i < n; ++i) {
+            std::byte *to = reinterpret_cast<std::byte*>(std::addressof(keys[i]));
+            length_type used;
+            getBytes(in, &used, sizeof(used));
+            std::memcpy(to, prefix.data(), p);
+            getBytes(in, to + p, used);
+            std::memset(to + p + used, 0, KEY_BYTES - p - used);
+        }
+    }
+    /* the most of the first n keys a Node can be stored with */
+    template <typename Node>
+    static auto fitting(const key_type *keys, size_type n) -> size_type {
+        n = std::min<size_type>(n, Node::MAX_KEY_NUM);
+        if (not COMPRESSED or n <= size_type(Node::SAFE_KEY_NUM)) return n;
+        size_type lo = Node::SAFE_KEY_NUM, hi = n;
+        while (lo < hi) {
+            size_type mid = (lo + hi + 1) / 2;
+            if (Node::encodedBytes(keys, mid) <= PAGE_BYTES) lo = mid;
+            else hi = mid - 1;
+        } return lo;
+    }
+    /* where to cut n keys of a full Node in two: the left part keeps the keys before it, the right
+     * one those from gap past it on. a node split by an append keeps nine tenths, as nothing but
+     * further appends is going to land in it */
+    template <typename Node>
+    static auto splitPoint(const key_type *keys, size_type n, size_type gap, bool append) -> size_type {
+        size_type mid = append ? n - gap - std::max<size_type>(n / 10, 1) : n / 2;
+        if constexpr (COMPRESSED) {
+            while (mid > 1 and Node::encodedBytes(keys, mid) > PAGE_BYTES) --mid;
+            while (mid + gap + 1 < n and Node::encodedBytes(keys + mid + gap, n - mid - gap) > PAGE_BYTES) ++mid;
+        } return mid;
+    }
+    auto separator(const key_type &lhs, const key_type &rhs) const -> key_type;
+
+    auto makeSlot(const value_type &value, const HardDisk::Record &hint) -> slot_type;
+    auto loadSlot(const slot_type &slot) -> value_type;
+    auto saveSlot(slot_type &slot, const value_type &value, const HardDisk::Record &hint) -> void;
+    auto dropSlot(const slot_type &slot) -> void;
+    auto store(leaf_node &u, const HardDisk::Record &rec, size_type loc, const value_type &value) -> u64;
+    /* a value that compares equal to the one it was loaded as need not be written back */
+    static auto same(const value_type &lhs, const value_type &rhs) -> bool {
+        if constexpr (std::equality_comparable<value_type>) return lhs == rhs;
+        else if constexpr (std::is_trivially_copyable_v<value_type>) return std::memcmp(std::addressof(lhs), std::addressof(rhs), sizeof(value_type)) == 0;
+        else return false;
+    }
+
+    /* how far apply(internal_node&, ...) takes the writes held on the way: post leaves them to the
+     * buffers as long as those have room, pull takes the ones on the wanted keys down to the leaves
+     * and drain all of them */
+    enum class delivery { post, pull, drain };
+    /* fold the write o into the older one held for the same key, so that applying the result does
+     * what applying both in turn would */
+    static auto fold(op &held, const op &o) -> void {
+        if (o.type != op::insert) held = o;
+        /* the key is gone by then, the insert will find it absent */
+        else if (held.type == op::erase) held.type = op::upsert, held.value = o.value;
+    }
 
 public:
-    bptree(const std::string & = std::string("data.bin"));
+    bptree(const std::string & = std::string("data.bin"), size_type cacheBytes = HardDisk::BufferPool::DEFAULT_CAPACITY);
     ~bptree();
 
+    auto flush() -> void;
+
     auto fileRef() -> HardDisk::FileWrapper& { return file; }
-    auto end() const -> iterator { return iterator(const_cast<Self*>(this), leaf_node(), -1); }
+    auto end() const -> iterator { return iterator(const_cast<Self*>(this), HardDisk::Record(), leaf_node(), -1); }
 
 private:
-    auto insert(leaf_node &self, const key_type &key, const value_type &value) -> std::pair<std::pair<iterator, bool>, bool>;
+    auto insert(leaf_node &self, const HardDisk::Record &rec, const key_type &key, const value_type &value) -> std::pair<std::pair<iterator, bool>, bool>;
     auto erase(leaf_node &self, const key_type &key) -> std::pair<bool, bool>;
-    auto find(leaf_node &self, const key_type &key) -> iterator;
-    auto value(leaf_node &self, const key_type &key) -> value_type;
-    auto lower_bound(leaf_node &self, const key_type &key) -> iterator;
+    auto find(const leaf_node &self, const HardDisk::Record &rec, const key_type &key) -> iterator;
+    auto value(const leaf_node &self, const key_type &key) -> value_type;
+    auto lower_bound(const leaf_node &self, const HardDisk::Record &rec, const key_type &key) -> iterator;
+    auto apply(leaf_node &self, const HardDisk::Record &rec, const op *first, const op *last, Vec<std::pair<key_type, HardDisk::Record>> &split) -> size_type;
 
     auto insert(internal_node &self, const key_type &key, const value_type &value) -> std::pair<std::pair<iterator, bool>, bool>;
     auto erase(internal_node &self, const key_type &key) -> std::pair<bool, bool>;
-    auto find(internal_node &self, const key_type &key) -> iterator;
-    auto value(internal_node &self, const key_type &key) -> value_type;
-    auto lower_bound(internal_node &self, const key_type &key) -> iterator;
+    auto find(const internal_node &self, const key_type &key) -> iterator;
+    auto value(const internal_node &self, const key_type &key) -> value_type;
+    auto lower_bound(const internal_node &self, const key_type &key) -> iterator;
+    auto apply(internal_node &self, const HardDisk::Record &rec, const op *first, const op *last, Vec<std::pair<key_type, HardDisk::Record>> &split,
+               delivery how = delivery::pull, std::span<const key_type> wanted = {}) -> size_type;
+    auto settle(const internal_node &self, const op *first, const op *last, delivery how, std::span<const key_type> wanted, Vec<op> &kept, Vec<op> &down) -> void;
+
+    auto split(internal_node &self, size_type loc, leaf_node &v, bool append = false) -> void;
+    auto split(internal_node &self, size_type loc, internal_node &v, bool append = false) -> void;
+    /* whether the insert that gave it took the key past every other one in the tree */
+    static auto appended(const iterator &it) -> bool { return it.self.right.empty() and it.loc + 1 == i32(it.self.size); }
+    auto freeLeaf(const HardDisk::Record &rec) -> void;
+    auto growRoot() -> void;
+    auto locate(const key_type &key) -> HardDisk::Record;
+    auto rebalance(bool subIsLeaf, key_type &key, const HardDisk::Record &lhs, const HardDisk::Record &rhs) -> bool;
+    auto stack(Vec<std::pair<key_type, HardDisk::Record>> level, Vec<tally_type> tallies, bool subIsLeaf, size_type nodeFill) -> void;
+    template <typename InputIt>
+    auto build(InputIt first, InputIt last, f64 fill) -> size_type;
+    auto release(const internal_node &self) -> void;
+    auto deliver(std::span<op> ops, delivery how, std::span<const key_type> wanted) -> size_type;
+    auto lookup(const key_type &key) -> std::optional<value_type>;
+    auto drain() -> void { if constexpr (BUFFERED) deliver({}, delivery::drain, {}); }
+
+    auto summarize(const leaf_node &u, size_type first, size_type last) -> aggregate_type;
+    auto tallyOf(const leaf_node &u) -> tally_type;
+    static auto tallyOf(const internal_node &u) -> tally_type;
+    auto tallyAt(bool isLeaf, const HardDisk::Record &rec) -> tally_type;
+    auto retally(internal_node &self, const key_type &key) -> void;
+    auto aggregateOf(const internal_node &self, const key_type *lo, const key_type *hi) -> aggregate_type;
+    auto rankOf(const key_type &key, bool inclusive) -> size_type;
 
 public:
     auto insert(const key_type &key, const value_type &value) -> std::pair<iterator, bool>;
+    auto insert_or_assign(const key_type &key, const value_type &value) -> std::pair<iterator, bool>;
+    template <typename Fn>
+    auto update(const key_type &key, Fn fn) -> bool;
     auto erase(const key_type &key) -> bool;
     auto find(const key_type &key) -> iterator;
     auto value(const key_type &key) -> value_type;
     auto lower_bound(const key_type &key) -> iterator;
+    auto multi_get(std::span<const key_type> keys) -> Vec<value_type>;
+
+    template <typename InputIt>
+    auto bulk_load(InputIt first, InputIt last, f64 fill = 1.0) -> size_type;
+    auto compact(f64 fill = 1.0) -> void;
+    auto apply_batch(std::span<op> ops) -> size_type;
+    auto post(std::span<op> ops) -> void;
+    auto post(const op &o) -> void { op copy = o; post(std::span(std::addressof(copy), 1)); }
+
+    auto scan(const key_type &lo, const key_type &hi, size_type readahead = 8) -> cursor;
+    auto rscan(const key_type &lo, const key_type &hi, size_type readahead = 8) -> cursor;
+
+    auto size() const -> size_type;
+    auto rank(const key_type &key) -> size_type;
+    auto nth(size_type i) -> iterator;
+    auto count(const key_type &lo, const key_type &hi) -> size_type;
+    auto aggregate(const key_type &lo, const key_type &hi) -> aggregate_type;
 };
 
 
-template <typename Key, typename Value, typename Compare, i32 FACTOR>
-struct bptree<Key, Value, Compare, FACTOR>::leaf_node {
-    static constexpr i32 MIN_KEY_NUM = (FACTOR - 1) / 2 - 1;
-    static constexpr i32 MAX_KEY_NUM = FACTOR - 1;
+template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+struct bptree<Key, Value, Compare, FACTOR, Traits>::leaf_node {
+    static constexpr i32 MIN_KEY_NUM = (LEAF_BASE - 1) / 2 - 1;
+    static constexpr i32 MAX_KEY_NUM = LEAF_FACTOR - 1;
     static constexpr i32 MAX_REC_NUM = MAX_KEY_NUM;
+    /* up to this many keys fit into a page however little they compress */
+    static constexpr i32 SAFE_KEY_NUM = LEAF_BASE - 1;
+    static constexpr size_type FILE_ALIGNMENT = NODE_ALIGNMENT;
+    static constexpr bool ENCODED = COMPRESSED;
+    static constexpr size_type FILE_BYTES = PAGE_BYTES;
 
     size_type           size;
     HardDisk::Record    left, right;
     key_type            key[MAX_KEY_NUM + 1];
-    HardDisk::Record    rec[MAX_REC_NUM + 1];
+    slot_type           rec[MAX_REC_NUM + 1];
+
+    static auto encodedBytes(const key_type *keys, size_type n) -> size_type {
+        return LEAF_HEAD + keysBytes(keys, n, sharedPrefix(keys, n)) + n * sizeof(slot_type);
+    }
 
-    auto full()    const -> bool { return size > MAX_KEY_NUM; }
+    auto full()    const -> bool { return size > MAX_KEY_NUM or (COMPRESSED and size > SAFE_KEY_NUM and encodedBytes(key, size) > PAGE_BYTES); }
     auto scanty()  const -> bool { return size < MIN_KEY_NUM; }
     auto surplus() const -> bool { return size > MIN_KEY_NUM; }
+    /* whether k can go in without making the leaf full */
+    auto room(const key_type &k) const -> bool {
+        if (size >= MAX_KEY_NUM) return false;
+        if (not COMPRESSED or size < SAFE_KEY_NUM) return true;
+        size_type p = sharedPrefix(key, size);
+        p = std::mismatch(keyBytes(k), keyBytes(k) + p, keyBytes(key[0])).first - keyBytes(k);
+        size_type bytes = LEAF_HEAD + keysBytes(key, size, p) + sizeof(length_type) + std::max(usedBytes(k), p) - p;
+        return bytes + (size + 1) * sizeof(slot_type) <= PAGE_BYTES;
+    }
+
+    auto encode(std::span<std::byte> out) const -> void {
+        putBytes(out, &size, sizeof(size)), putBytes(out, &left, sizeof(left)), putBytes(out, &right, sizeof(right));
+        putKeys(out, key, size);
+        putBytes(out, rec, size * sizeof(slot_type));
+    }
+    auto decode(std::span<const std::byte> in) -> void {
+        getBytes(in, &size, sizeof(size)), getBytes(in, &left, sizeof(left)), getBytes(in, &right, sizeof(right));
+        getKeys(in, key, size);
+        getBytes(in, rec, size * sizeof(slot_type));
+    }
 
     leaf_node(): size(0) {}
 };
 
-/* impl bptree<Key, Value, Compare, FACTOR>::leaf_node { */
+/* impl bptree<Key, Value, Compare, FACTOR, Traits>::leaf_node { */
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::insert(leaf_node &self, const key_type &key, const value_type &value) -> std::pair<std::pair<iterator, bool>, bool> {
-        size_type loc = std::lower_bound(self.key, self.key + self.size, key, key_le) - self.key;
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::insert(leaf_node &self, const HardDisk::Record &rec, const key_type &key, const value_type &value) -> std::pair<std::pair<iterator, bool>, bool> {
+        size_type loc = key_lower(self.key, self.size, key);
         if (loc < self.size and key_eq(key, self.key[loc]))
-            return std::make_pair(std::make_pair(iterator(this, self, loc), false), false);
+            return std::make_pair(std::make_pair(iterator(this, rec, self, loc), false), false);
         else {
+            filterAdd(key);
             std::move_backward(self.key + loc, self.key + self.size, self.key + self.size + 1);
             std::move_backward(self.rec + loc, self.rec + self.size, self.rec + self.size + 1);
             self.key[loc] = key;
-            self.rec[loc] = dataPool.alloc().save(file, value);
+            self.rec[loc] = makeSlot(value, rec);
             ++self.size;
-            return std::make_pair(std::make_pair(iterator(this, self, loc), true), true);
+            return std::make_pair(std::make_pair(iterator(this, rec, self, loc), true), true);
         }
     }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::erase(leaf_node &self, const key_type &key) -> std::pair<bool, bool> {
-        size_type loc = std::lower_bound(self.key, self.key + self.size, key, key_le) - self.key;
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::erase(leaf_node &self, const key_type &key) -> std::pair<bool, bool> {
+        size_type loc = key_lower(self.key, self.size, key);
         if (loc < self.size and key_eq(key, self.key[loc])) {
-            dataPool.dealloc(self.rec[loc]);
+            dropSlot(self.rec[loc]);
+            filterErase();
             std::move(self.key + loc + 1, self.key + self.size, self.key + loc);
             std::move(self.rec + loc + 1, self.rec + self.size, self.rec + loc);
             --self.size;
@@ -120,143 +632,202 @@ struct bptree<Key, Value, Compare, FACTOR>::leaf_node {
         } return std::make_pair(false, false);
     }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::find(leaf_node &self, const key_type &key) -> iterator {
-        size_type loc = std::lower_bound(self.key, self.key + self.size, key, key_le) - self.key;
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::find(const leaf_node &self, const HardDisk::Record &rec, const key_type &key) -> iterator {
+        size_type loc = key_lower(self.key, self.size, key);
         if (loc < self.size and key_eq(key, self.key[loc]))
-            return iterator(this, self, loc);
-        return iterator();
+            return iterator(this, rec, self, loc);
+        return end();
     }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::value(leaf_node &self, const key_type &key) -> value_type {
-        size_type loc = std::lower_bound(self.key, self.key + self.size, key, key_le) - self.key;
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::value(const leaf_node &self, const key_type &key) -> value_type {
+        size_type loc = key_lower(self.key, self.size, key);
         if (loc < self.size and key_eq(key, self.key[loc]))
-            return self.rec[loc].template get<value_type>(file);
+            return loadSlot(self.rec[loc]);
         return value_type();
         throw "in bptree::value(): key not found";
     }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::lower_bound(leaf_node &self, const key_type &key) -> iterator {
-        size_type loc = std::lower_bound(self.key, self.key + self.size, key, key_le) - self.key;
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::lower_bound(const leaf_node &self, const HardDisk::Record &rec, const key_type &key) -> iterator {
+        size_type loc = key_lower(self.key, self.size, key);
         if (loc < self.size)
-            return iterator(this, self, loc);
-        return iterator(this, self, loc - 1) + 1;
+            return iterator(this, rec, self, loc);
+        return iterator(this, rec, self, loc - 1) + 1;
+    }
+
+    /* merge the sorted ops into the leaf, entries that no longer fit go to fresh right siblings
+     * which are reported through split */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::apply(leaf_node &self, const HardDisk::Record &rec, const op *first, const op *last, Vec<std::pair<key_type, HardDisk::Record>> &split) -> size_type {
+        Vec<key_type> keys;
+        Vec<slot_type> recs;
+        keys.reserve(self.size + (last - first));
+        recs.reserve(self.size + (last - first));
+
+        size_type changed = 0, i = 0;
+        for (const op *it = first; it != last; ) {
+            for (; i < self.size and key_le(self.key[i], it->key); ++i)
+                keys.push_back(self.key[i]), recs.push_back(self.rec[i]);
+
+            const key_type &key = it->key;
+            bool present = i < self.size and key_eq(self.key[i], key);
+            slot_type data = present ? self.rec[i++] : slot_type();
+            for (; it != last and key_eq(it->key, key); ++it) {
+                if (it->type == op::erase) {
+                    if (present) dropSlot(data), filterErase(), present = false, ++changed;
+                } else if (not present) {
+                    filterAdd(key);
+                    data = makeSlot(it->value, rec), present = true, ++changed;
+                } else if (it->type == op::upsert) {
+                    saveSlot(data, it->value, rec), ++changed;
+                }
+            }
+            if (present) keys.push_back(key), recs.push_back(data);
+        }
+        for (; i < self.size; ++i)
+            keys.push_back(self.key[i]), recs.push_back(self.rec[i]);
+
+        /* cut into the fewest pieces that fit, the first one stays in self */
+        size_type n = keys.size(), m = (n + leaf_node::MAX_KEY_NUM - 1) / leaf_node::MAX_KEY_NUM;
+        auto fit = [&](size_type pieces) {
+            for (size_type j = 0; j < pieces; ++j)
+                if (size_type lo = j * n / pieces, hi = (j + 1) * n / pieces; fitting<leaf_node>(keys.data() + lo, hi - lo) < hi - lo) return false;
+            return true;
+        };
+        if constexpr (COMPRESSED) while (not fit(m)) ++m;
+        if (m <= 1) {
+            std::move(keys.begin(), keys.end(), self.key);
+            std::move(recs.begin(), recs.end(), self.rec);
+            self.size = n;
+            return changed;
+        }
+
+        HardDisk::Record right = self.right, prev = rec;
+        HardDisk::BufferPool::handle<leaf_node> last_piece;
+        self.size = n / m;
+        std::move(keys.begin(), keys.begin() + self.size, self.key);
+        std::move(recs.begin(), recs.begin() + self.size, self.rec);
+        for (size_type j = 1; j < m; ++j) {
+            size_type lo = j * n / m, hi = (j + 1) * n / m;
+            HardDisk::Record cur = leafNodePool.alloc(prev);
+            auto w = createNode<leaf_node>(cur);
+            std::move(keys.begin() + lo, keys.begin() + hi, w->key);
+            std::move(recs.begin() + lo, recs.begin() + hi, w->rec);
+            w->size = hi - lo;
+            w->left = prev;
+            w->right = right;
+            w.dirty();
+            (j == 1 ? self.right : last_piece->right) = cur;
+            split.emplace_back(separator(j == 1 ? self.key[self.size - 1] : last_piece->key[last_piece->size - 1], w->key[0]), cur);
+            last_piece = std::move(w);
+            prev = cur;
+        }
+        if (not right.empty()) {
+            auto t = pinNode<leaf_node>(right);
+            t->left = prev;
+            t.dirty();
+        }
+        return changed;
     }
 
 /* } */
 
 
-template <typename Key, typename Value, typename Compare, i32 FACTOR>
-struct bptree<Key, Value, Compare, FACTOR>::internal_node {
-    static constexpr i32 MIN_KEY_NUM = (FACTOR - 1) / 2 - 1;
-    static constexpr i32 MAX_KEY_NUM = FACTOR - 1;
+template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+struct bptree<Key, Value, Compare, FACTOR, Traits>::internal_node: std::conditional_t<BUFFERED, message_buffer, no_message_buffer>, std::conditional_t<TALLIED, subtree_tallies, no_subtree_tallies> {
+    static constexpr i32 MIN_KEY_NUM = (INTERNAL_BASE - 1) / 2 - 1;
+    static constexpr i32 MAX_KEY_NUM = INTERNAL_FACTOR - 1;
     static constexpr i32 MAX_SUB_NUM = MAX_KEY_NUM + 1;
+    /* up to this many keys fit into a page however little they compress */
+    static constexpr i32 SAFE_KEY_NUM = INTERNAL_BASE - 1;
+    static constexpr size_type FILE_ALIGNMENT = NODE_ALIGNMENT;
+    static constexpr bool ENCODED = COMPRESSED;
+    static constexpr size_type FILE_BYTES = PAGE_BYTES;
 
     bool                subIsLeaf;
     size_type           size;
     key_type            key[MAX_KEY_NUM + 1];
     HardDisk::Record    sub[MAX_SUB_NUM + 1];
 
-    auto full()    const -> bool { return size > MAX_KEY_NUM; }
+    static auto encodedBytes(const key_type *keys, size_type n) -> size_type {
+        return INTERNAL_HEAD + keysBytes(keys, n, sharedPrefix(keys, n)) + n * (sizeof(HardDisk::Record) + TALLY_BYTES);
+    }
+
+    auto full()    const -> bool { return size > MAX_KEY_NUM or (COMPRESSED and size > SAFE_KEY_NUM and encodedBytes(key, size) > PAGE_BYTES); }
     auto scanty()  const -> bool { return size < MIN_KEY_NUM; }
     auto surplus() const -> bool { return size > MIN_KEY_NUM; }
 
     internal_node(): subIsLeaf(false), size(0) {}
+
+    auto encode(std::span<std::byte> out) const -> void {
+        u8 leaves = subIsLeaf;
+        putBytes(out, &leaves, sizeof(leaves)), putBytes(out, &size, sizeof(size));
+        putKeys(out, key, size);
+        putBytes(out, sub, (size + 1) * sizeof(HardDisk::Record));
+        if constexpr (TALLIED) putBytes(out, this->tally, (size + 1) * sizeof(tally_type));
+    }
+    auto decode(std::span<const std::byte> in) -> void {
+        u8 leaves;
+        getBytes(in, &leaves, sizeof(leaves)), getBytes(in, &size, sizeof(size));
+        subIsLeaf = leaves;
+        getKeys(in, key, size);
+        getBytes(in, sub, (size + 1) * sizeof(HardDisk::Record));
+        if constexpr (TALLIED) getBytes(in, this->tally, (size + 1) * sizeof(tally_type));
+    }
 };
 
-/* impl bptree<Key, Value, Compare, FACTOR>::internal_node { */
+/* impl bptree<Key, Value, Compare, FACTOR, Traits>::internal_node { */
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::insert(internal_node &self, const key_type &key, const value_type &value) -> std::pair<std::pair<iterator, bool>, bool> {
-        size_type loc = std::upper_bound(self.key, self.key + self.size, key, key_le) - self.key;
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::insert(internal_node &self, const key_type &key, const value_type &value) -> std::pair<std::pair<iterator, bool>, bool> {
+        size_type loc = key_upper(self.key, self.size, key);
         std::pair<std::pair<iterator, bool>, bool> result;
         if (self.subIsLeaf) {
-            leaf_node *v = static_cast<leaf_node*>(std::malloc(sizeof(leaf_node)));
-            self.sub[loc].load(file, *v);
-            result = insert(*v, key, value);
+            auto v = pinNode<leaf_node>(self.sub[loc]);
+            result = insert(*v, self.sub[loc], key, value);
+            if constexpr (TALLIED) if (result.second) self.tally[loc] = tallyOf(*v);
 
             /* if full then split */
-            if (v->full()) {
-                leaf_node *w = static_cast<leaf_node*>(std::malloc(sizeof(leaf_node)));
-                std::move(v->key + (FACTOR / 2), v->key + v->size, w->key);
-                std::move(v->rec + (FACTOR / 2), v->rec + v->size, w->rec);
-                w->size = v->size - (FACTOR / 2);
-                v->size = (FACTOR / 2);
-
-                std::move_backward(self.key + loc,     self.key + self.size,     self.key + self.size + 1);
-                std::move_backward(self.sub + loc + 1, self.sub + self.size + 1, self.sub + self.size + 2);
-                self.key[loc] = w->key[0];
-                ++self.size;
-
-
-                w->left = self.sub[loc];
-                w->right = std::move(v->right);
-                self.sub[loc + 1] = leafNodePool.alloc().save(file, *w);
-
-                v->right = self.sub[loc + 1];
-                self.sub[loc].save(file, *v);
-
-                if (not w->right.empty()) {
-                    leaf_node *t = static_cast<leaf_node*>(std::malloc(sizeof(leaf_node)));
-                    w->right.load(file, *t);
-                    t->left = v->right;
-                    w->right.save(file, *t);
-                    std::free(t);
-                }
-
-                std::free(v); std::free(w);
+            if (result.first.second and v->full()) {
+                split(self, loc, *v, appended(result.first.first));
+                v.dirty();
                 return result.first.second = true, result;
             }
             if (result.first.second)
-                self.sub[loc].save(file, *v),
+                v.dirty(),
                 result.first.second = false;
-            std::free(v);
         } else {
-            internal_node *v = static_cast<internal_node*>(std::malloc(sizeof(internal_node)));
-            self.sub[loc].load(file, *v);
+            auto v = pinNode<internal_node>(self.sub[loc]);
             result = insert(*v, key, value);
+            if constexpr (TALLIED) if (result.second) self.tally[loc] = tallyOf(*v);
 
             /* if full then split */
-            if (v->full()) {
-                internal_node *w = static_cast<internal_node*>(std::malloc(sizeof(internal_node)));
-                std::move(v->key + (FACTOR / 2) + 1, v->key + v->size,     w->key);
-                std::move(v->sub + (FACTOR / 2) + 1, v->sub + v->size + 1, w->sub);
-                w->size = v->size - (FACTOR / 2) - 1;
-                v->size = (FACTOR / 2);
-                w->subIsLeaf = v->subIsLeaf;
-
-                std::move_backward(self.key + loc,     self.key + self.size,     self.key + self.size + 1);
-                std::move_backward(self.sub + loc + 1, self.sub + self.size + 1, self.sub + self.size + 2);
-                self.key[loc] = std::move(v->key[FACTOR / 2]);
-                ++self.size;
-
-                self.sub[loc].save(file, *v);
-                self.sub[loc + 1] = internalNodePool.alloc().save(file, *w);
-                std::free(v); std::free(w);
+            if (result.first.second and v->full()) {
+                split(self, loc, *v, appended(result.first.first));
+                v.dirty();
                 return result.first.second = true, result;
             }
-            if (result.first.second)
-                self.sub[loc].save(file, *v),
+            /* a tally changed on the way even if nothing else did */
+            if (result.first.second or (TALLIED and result.second))
+                v.dirty(),
                 result.first.second = false;
-            std::free(v);
         } return result;
     }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::erase(internal_node &self, const key_type &key) -> std::pair<bool, bool> {
-        size_type loc = std::upper_bound(self.key, self.key + self.size, key, key_le) - self.key;
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::erase(internal_node &self, const key_type &key) -> std::pair<bool, bool> {
+        size_type loc = key_upper(self.key, self.size, key);
         std::pair<bool, bool> result;
         if (self.subIsLeaf) {
-            leaf_node *v = static_cast<leaf_node*>(std::malloc(sizeof(leaf_node)));
-            self.sub[loc].load(file, *v);
+            auto v = pinNode<leaf_node>(self.sub[loc]);
             result = erase(*v, key);
+            if constexpr (TALLIED) if (result.second) self.tally[loc] = tallyOf(*v);
 
             if (v->scanty()) {
                 if (0 < loc) {
-                    leaf_node *w = static_cast<leaf_node*>(std::malloc(sizeof(leaf_node)));
-                    self.sub[loc - 1].load(file, *w);
+                    auto w = pinNode<leaf_node>(self.sub[loc - 1]);
 
                     if (w->surplus()) {
                         /* get key from surplus brothers */
@@ -267,8 +838,9 @@ struct bptree<Key, Value, Compare, FACTOR>::internal_node {
                         v->rec[0] = std::move(w->rec[w->size]);
                         ++v->size;
 
-                        self.key[loc - 1] = v->key[0];
-                        self.sub[loc].save(file, *v);
+                        self.key[loc - 1] = separator(w->key[w->size - 1], v->key[0]);
+                        if constexpr (TALLIED) self.tally[loc - 1] = tallyOf(*w), self.tally[loc] = tallyOf(*v);
+                        v.dirty();
                     } else {
                         /* merge with brothers */
                         std::move(v->key, v->key + v->size, w->key + w->size);
@@ -278,26 +850,22 @@ struct bptree<Key, Value, Compare, FACTOR>::internal_node {
 
                         w->right = std::move(v->right);
                         if (not w->right.empty()) {
-                            leaf_node *t = static_cast<leaf_node*>(std::malloc(sizeof(leaf_node)));
-                            w->right.load(file, *t);
+                            auto t = pinNode<leaf_node>(w->right);
                             t->left = std::move(v->left);
-                            w->right.save(file, *t);
-                            std::free(t);
+                            t.dirty();
                         }
 
-                        self.sub[loc].save(file, *v);
-                        leafNodePool.dealloc(self.sub[loc]);
+                        freeLeaf(self.sub[loc]);
                         std::move(self.key + loc,     self.key + self.size,     self.key + loc - 1);
                         std::move(self.sub + loc + 1, self.sub + self.size + 1, self.sub + loc    );
+                        if constexpr (TALLIED) self.tally[loc - 1] = tallyOf(*w), std::move(self.tally + loc + 1, self.tally + self.size + 1, self.tally + loc);
                         --self.size;
                     }
-                    self.sub[loc - 1].save(file, *w);
-                    std::free(v); std::free(w);
+                    w.dirty();
                     return std::make_pair(true, result.second);
                 }
                 if (loc < self.size) {
-                    leaf_node *w = static_cast<leaf_node*>(std::malloc(sizeof(leaf_node)));
-                    self.sub[loc + 1].load(file, *w);
+                    auto w = pinNode<leaf_node>(self.sub[loc + 1]);
 
                     if (w->surplus()) {
                         v->key[v->size] = std::move(w->key[0]);
@@ -307,8 +875,9 @@ struct bptree<Key, Value, Compare, FACTOR>::internal_node {
                         std::move(w->rec + 1, w->rec + w->size, w->rec);
                         --w->size;
 
-                        self.key[loc] = w->key[0];
-                        self.sub[loc + 1].save(file, *w);
+                        self.key[loc] = separator(v->key[v->size - 1], w->key[0]);
+                        if constexpr (TALLIED) self.tally[loc] = tallyOf(*v), self.tally[loc + 1] = tallyOf(*w);
+                        w.dirty();
                     } else {
                         std::move(w->key, w->key + w->size, v->key + v->size);
                         std::move(w->rec, w->rec + w->size, v->rec + v->size);
@@ -317,226 +886,1532 @@ struct bptree<Key, Value, Compare, FACTOR>::internal_node {
 
                         v->right = std::move(w->right);
                         if (not v->right.empty()) {
-                            leaf_node *t = static_cast<leaf_node*>(std::malloc(sizeof(leaf_node)));
-                            v->right.load(file, *t);
+                            auto t = pinNode<leaf_node>(v->right);
                             t->left = std::move(w->left);
-                            v->right.save(file, *t);
-                            std::free(t);
+                            t.dirty();
                         }
 
-                        self.sub[loc + 1].save(file, *w);
-                        leafNodePool.dealloc(self.sub[loc + 1]);
+                        freeLeaf(self.sub[loc + 1]);
                         std::move(self.key + loc + 1, self.key + self.size,     self.key + loc    );
                         std::move(self.sub + loc + 2, self.sub + self.size + 1, self.sub + loc + 1);
+                        if constexpr (TALLIED) self.tally[loc] = tallyOf(*v), std::move(self.tally + loc + 2, self.tally + self.size + 1, self.tally + loc + 1);
                         --self.size;
                     }
 
-                    self.sub[loc].save(file, *v);
-                    std::free(v); std::free(w);
+                    v.dirty();
                     return std::make_pair(true, result.second);
                 }
             }
-            if (result.first) self.sub[loc].save(file, *v);
-            std::free(v);
+            if (result.first) v.dirty();
         } else {
-            internal_node *v = static_cast<internal_node*>(std::malloc(sizeof(internal_node)));
-            self.sub[loc].load(file, *v);
+            auto v = pinNode<internal_node>(self.sub[loc]);
             result = erase(*v, key);
+            if constexpr (TALLIED) if (result.second) self.tally[loc] = tallyOf(*v);
 
+            /* a separator that took the place of another may not compress as well */
+            if (COMPRESSED and result.first and v->full()) {
+                split(self, loc, *v);
+                v.dirty();
+                return std::make_pair(true, result.second);
+            }
             if (v->scanty()) {
                 if (0 < loc) {
-                    internal_node *w = static_cast<internal_node*>(std::malloc(sizeof(internal_node)));
-                    self.sub[loc - 1].load(file, *w);
+                    auto w = pinNode<internal_node>(self.sub[loc - 1]);
 
                     if (w->surplus()) {
                         /* get key from surplus brothers */
                         std::move_backward(v->key, v->key + v->size,     v->key + v->size + 1);
                         std::move_backward(v->sub, v->sub + v->size + 1, v->sub + v->size + 2);
+                        if constexpr (TALLIED) std::move_backward(v->tally, v->tally + v->size + 1, v->tally + v->size + 2);
                         ++v->size;
                         v->key[0] = std::move(self.key[loc - 1]);
                         self.key[loc - 1] = std::move(w->key[w->size - 1]);
                         v->sub[0] = std::move(w->sub[w->size]);
+                        if constexpr (TALLIED) v->tally[0] = w->tally[w->size];
                         --w->size;
+                        if constexpr (TALLIED) self.tally[loc - 1] = tallyOf(*w), self.tally[loc] = tallyOf(*v);
 
-                        self.sub[loc].save(file, *v);
+                        v.dirty();
                     } else {
                         /* merge with brothers */
                         w->key[w->size] = std::move(self.key[loc - 1]);
                         std::move(v->key, v->key + v->size,     w->key + w->size + 1);
                         std::move(v->sub, v->sub + v->size + 1, w->sub + w->size + 1);
+                        if constexpr (TALLIED) std::move(v->tally, v->tally + v->size + 1, w->tally + w->size + 1);
                         w->size += v->size + 1;
                         v->size = 0;
 
+                        nodeCache.discard(self.sub[loc]);
                         internalNodePool.dealloc(self.sub[loc]);
                         std::move(self.key + loc,     self.key + self.size,     self.key + loc - 1);
                         std::move(self.sub + loc + 1, self.sub + self.size + 1, self.sub + loc    );
+                        if constexpr (TALLIED) self.tally[loc - 1] = tallyOf(*w), std::move(self.tally + loc + 1, self.tally + self.size + 1, self.tally + loc);
                         --self.size;
                     }
 
-                    self.sub[loc - 1].save(file, *w);
-                    std::free(v); std::free(w);
+                    w.dirty();
                     return std::make_pair(true, result.second);
                 }
                 if (loc < self.size) {
-                    internal_node *w = static_cast<internal_node*>(std::malloc(sizeof(internal_node)));
-                    self.sub[loc + 1].load(file, *w);
+                    auto w = pinNode<internal_node>(self.sub[loc + 1]);
 
                     if (w->surplus()) {
                         v->key[v->size] = std::move(self.key[loc]);
                         self.key[loc] = std::move(w->key[0]);
                         v->sub[v->size + 1] = std::move(w->sub[0]);
+                        if constexpr (TALLIED) v->tally[v->size + 1] = w->tally[0], std::move(w->tally + 1, w->tally + w->size + 1, w->tally);
                         ++v->size;
                         std::move(w->key + 1, w->key + w->size,     w->key);
                         std::move(w->sub + 1, w->sub + w->size + 1, w->sub);
                         --w->size;
+                        if constexpr (TALLIED) self.tally[loc] = tallyOf(*v), self.tally[loc + 1] = tallyOf(*w);
 
-                        self.sub[loc + 1].save(file, *w);
+                        w.dirty();
                     } else {
                         v->key[v->size] = std::move(self.key[loc]);
                         std::move(w->key, w->key + w->size,     v->key + v->size + 1);
                         std::move(w->sub, w->sub + w->size + 1, v->sub + v->size + 1);
+                        if constexpr (TALLIED) std::move(w->tally, w->tally + w->size + 1, v->tally + v->size + 1);
                         v->size += w->size + 1;
                         w->size = 0;
 
+                        nodeCache.discard(self.sub[loc + 1]);
                         internalNodePool.dealloc(self.sub[loc + 1]);
                         std::move(self.key + loc + 1, self.key + self.size,     self.key + loc    );
                         std::move(self.sub + loc + 2, self.sub + self.size + 1, self.sub + loc + 1);
+                        if constexpr (TALLIED) self.tally[loc] = tallyOf(*v), std::move(self.tally + loc + 2, self.tally + self.size + 1, self.tally + loc + 1);
                         --self.size;
                     }
 
-                    self.sub[loc].save(file, *v);
-                    std::free(v); std::free(w);
+                    v.dirty();
                     return std::make_pair(true, result.second);
                 }
             }
-            if (result.first) self.sub[loc].save(file, *v);
-            std::free(v);
+            if (result.first or (TALLIED and result.second)) v.dirty();
         } return std::make_pair(false, result.second);
     }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::find(internal_node &self, const key_type &key) -> iterator {
-        size_type loc = std::upper_bound(self.key, self.key + self.size, key, key_le) - self.key;
-        if (self.subIsLeaf) {
-            leaf_node *v = static_cast<leaf_node*>(std::malloc(sizeof(leaf_node)));
-            self.sub[loc].load(file, *v);
-            auto tmp = find(*v, key);
-            std::free(v);
-            return tmp;
-        } else {
-            internal_node *v = static_cast<internal_node*>(std::malloc(sizeof(internal_node)));
-            self.sub[loc].load(file, *v);
-            auto tmp = find(*v, key);
-            std::free(v);
-            return tmp;
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::find(const internal_node &self, const key_type &key) -> iterator {
+        size_type loc = key_upper(self.key, self.size, key);
+        if (self.subIsLeaf)
+            return find(*nodeCache.template peek<leaf_node>(self.sub[loc]), self.sub[loc], key);
+        return find(*nodeCache.template peek<internal_node>(self.sub[loc]), key);
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::value(const internal_node &self, const key_type &key) -> value_type {
+        size_type loc = key_upper(self.key, self.size, key);
+        if (self.subIsLeaf)
+            return value(*nodeCache.template peek<leaf_node>(self.sub[loc]), key);
+        return value(*nodeCache.template peek<internal_node>(self.sub[loc]), key);
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::lower_bound(const internal_node &self, const key_type &key) -> iterator {
+        size_type loc = key_upper(self.key, self.size, key);
+        if (self.subIsLeaf)
+            return lower_bound(*nodeCache.template peek<leaf_node>(self.sub[loc]), self.sub[loc], key);
+        return lower_bound(*nodeCache.template peek<internal_node>(self.sub[loc]), key);
+    }
+
+    /* route the sorted ops to the children, every touched child is loaded and saved once. children
+     * left scanty are evened out with a neighbour, and if self ends up with too many children it is
+     * cut into pieces like a leaf in apply(leaf_node&, ...).
+     * in write-optimized mode the writes self holds are sorted out by settle() first, and those it
+     * keeps go with the pieces they are for */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::apply(internal_node &self, const HardDisk::Record &rec, const op *first, const op *last, Vec<std::pair<key_type, HardDisk::Record>> &split,
+                                                            delivery how, std::span<const key_type> wanted) -> size_type {
+        Vec<key_type> keys;
+        Vec<HardDisk::Record> subs;
+        Vec<tally_type> tallies;
+        Vec<bool> touched;
+        auto below = [this](const op &lhs, const key_type &rhs) { return key_le(lhs.key, rhs); };
+
+        Vec<op> kept, down;
+        if constexpr (BUFFERED) {
+            /* posted ops that fit into the buffer stay there without a child being looked at */
+            if (how == delivery::post and self.pending + (last - first) <= MESSAGE_BUFFER) {
+                for (; first != last; ++first) {
+                    op *end = self.message + self.pending, *at = std::lower_bound(self.message, end, first->key, below);
+                    if (at != end and key_eq(at->key, first->key)) fold(*at, *first);
+                    else std::move_backward(at, end, end + 1), *at = *first, ++self.pending;
+                }
+                return 0;
+            }
+            settle(self, first, last, how, wanted, kept, down);
+            first = down.data(), last = down.data() + down.size();
         }
+
+        size_type changed = 0;
+        for (size_type loc = 0; loc <= self.size; ++loc) {
+            const op *bound = loc == self.size ? last : std::lower_bound(first, last, self.key[loc], below);
+            std::span<const key_type> part;
+            if constexpr (BUFFERED) {
+                auto at = loc == self.size ? wanted.end() : std::lower_bound(wanted.begin(), wanted.end(), self.key[loc], key_le);
+                part = std::span(wanted.begin(), at), wanted = std::span(at, wanted.end());
+            }
+            /* a child holding writes may have some to pass on even if no op reaches it */
+            bool visit = first != bound or (BUFFERED and not self.subIsLeaf and (how == delivery::drain or (how == delivery::pull and not part.empty())));
+            if (loc > 0) keys.push_back(self.key[loc - 1]);
+            subs.push_back(self.sub[loc]);
+            if constexpr (TALLIED) tallies.push_back(self.tally[loc]);
+            touched.push_back(visit);
+            if (not visit) continue;
+
+            Vec<std::pair<key_type, HardDisk::Record>> pieces;
+            if (self.subIsLeaf) {
+                auto v = pinNode<leaf_node>(self.sub[loc]);
+                if (size_type n = apply(*v, self.sub[loc], first, bound, pieces); n > 0)
+                    changed += n, v.dirty();
+                if constexpr (TALLIED) tallies.back() = tallyOf(*v);
+            } else {
+                auto v = pinNode<internal_node>(self.sub[loc]);
+                auto pending = [&] { if constexpr (BUFFERED) return v->pending; else return size_type(0); };
+                size_type held = pending();
+                if (size_type n = apply(*v, self.sub[loc], first, bound, pieces, how, part); n > 0 or (BUFFERED and (first != bound or pending() != held)))
+                    changed += n, v.dirty();
+                if constexpr (TALLIED) tallies.back() = tallyOf(*v);
+            }
+            for (auto &[key, sub]: pieces) {
+                keys.push_back(key), subs.push_back(sub), touched.push_back(false);
+                if constexpr (TALLIED) tallies.push_back(tallyAt(self.subIsLeaf, sub));
+            }
+            first = bound;
+        }
+
+        for (size_type i = 0; i < subs.size() and subs.size() > 1; ) {
+            bool scanty = touched[i] and (self.subIsLeaf ? pinNode<leaf_node>(subs[i])->scanty() : pinNode<internal_node>(subs[i])->scanty());
+            if (not scanty) { ++i; continue; }
+            size_type l = i + 1 < subs.size() ? i : i - 1;
+            if (rebalance(self.subIsLeaf, keys[l], subs[l], subs[l + 1])) {
+                keys.erase(keys.begin() + l);
+                subs.erase(subs.begin() + l + 1);
+                touched.erase(touched.begin() + l + 1);
+                if constexpr (TALLIED) tallies[l] = tallyAt(self.subIsLeaf, subs[l]), tallies.erase(tallies.begin() + l + 1);
+                touched[i = l] = true;
+            } else {
+                if constexpr (TALLIED) tallies[l] = tallyAt(self.subIsLeaf, subs[l]), tallies[l + 1] = tallyAt(self.subIsLeaf, subs[l + 1]);
+                i = l + 2;
+            }
+        }
+
+        size_type n = subs.size(), m = (n + internal_node::MAX_SUB_NUM - 1) / internal_node::MAX_SUB_NUM;
+        auto fit = [&](size_type pieces) {
+            for (size_type j = 0; j < pieces; ++j)
+                if (size_type lo = j * n / pieces, hi = (j + 1) * n / pieces; fitting<internal_node>(keys.data() + lo, hi - lo - 1) < hi - lo - 1) return false;
+            return true;
+        };
+        if constexpr (COMPRESSED) while (not fit(m)) ++m;
+        /* piece j holds the kept writes from the separator in front of it on */
+        auto hold = [&](internal_node &u, size_type j) {
+            if constexpr (BUFFERED) {
+                auto from = [&](size_type i) { return i == 0 ? kept.begin() : i == m ? kept.end() : std::lower_bound(kept.begin(), kept.end(), keys[i * n / m - 1], below); };
+                auto lo = from(j), hi = from(j + 1);
+                u.pending = hi - lo;
+                std::move(lo, hi, u.message);
+            }
+        };
+        self.size = n / m - 1;
+        std::move(keys.begin(), keys.begin() + self.size, self.key);
+        std::move(subs.begin(), subs.begin() + self.size + 1, self.sub);
+        if constexpr (TALLIED) std::move(tallies.begin(), tallies.begin() + self.size + 1, self.tally);
+        hold(self, 0);
+        for (size_type j = 1; j < m; ++j) {
+            size_type lo = j * n / m, hi = (j + 1) * n / m;
+            HardDisk::Record cur = internalNodePool.alloc(rec);
+            auto w = createNode<internal_node>(cur);
+            w->subIsLeaf = self.subIsLeaf;
+            w->size = hi - lo - 1;
+            std::move(keys.begin() + lo, keys.begin() + hi - 1, w->key);
+            std::move(subs.begin() + lo, subs.begin() + hi,     w->sub);
+            if constexpr (TALLIED) std::move(tallies.begin() + lo, tallies.begin() + hi, w->tally);
+            hold(*w, j);
+            w.dirty();
+            split.emplace_back(keys[lo - 1], cur);
+        }
+        return changed;
     }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::value(internal_node &self, const key_type &key) -> value_type {
-        size_type loc = std::upper_bound(self.key, self.key + self.size, key, key_le) - self.key;
-        if (self.subIsLeaf) {
-            leaf_node *v = static_cast<leaf_node*>(std::malloc(sizeof(leaf_node)));
-            self.sub[loc].load(file, *v);
-            auto tmp = value(*v, key);
-            std::free(v);
-            return tmp;
-        } else {
-            internal_node *v = static_cast<internal_node*>(std::malloc(sizeof(internal_node)));
-            self.sub[loc].load(file, *v);
-            auto tmp = value(*v, key);
-            std::free(v);
-            return tmp;
+    /* sort out what self holds in write-optimized mode: kept is what it is to hold afterwards, down
+     * the writes to pass on to its children, sorted by key with the older of a key first.
+     * posted ops fold into the writes held for their keys; if that leaves more than MESSAGE_BUFFER,
+     * the writes of the children most of them are for go down until few enough are left, so that
+     * every pass down moves as many writes as it can. otherwise what is held for the wanted keys,
+     * or all of it, goes down ahead of the ops */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::settle(const internal_node &self, const op *first, const op *last, delivery how, std::span<const key_type> wanted, Vec<op> &kept, Vec<op> &down) -> void {
+        auto byKey = [this](const op &lhs, const op &rhs) { return key_le(lhs.key, rhs.key); };
+        auto below = [this](const op &lhs, const key_type &rhs) { return key_le(lhs.key, rhs); };
+        Vec<op> held(self.message, self.message + self.pending);
+        if (how != delivery::post) {
+            Vec<op> taken;
+            for (op &o: held)
+                (how == delivery::drain or std::binary_search(wanted.begin(), wanted.end(), o.key, key_le) ? taken : kept).push_back(std::move(o));
+            down.reserve(taken.size() + (last - first));
+            std::merge(taken.begin(), taken.end(), first, last, std::back_inserter(down), byKey);
+            return;
         }
+
+        Vec<op> merged;
+        merged.reserve(held.size() + (last - first));
+        std::merge(held.begin(), held.end(), first, last, std::back_inserter(merged), byKey);
+        for (op &o: merged) {
+            if (not kept.empty() and key_eq(kept.back().key, o.key)) fold(kept.back(), o);
+            else kept.push_back(std::move(o));
+        }
+        if (kept.size() <= MESSAGE_BUFFER) return;
+
+        /* the writes for child loc are those from run[loc] to run[loc + 1] */
+        Vec<size_type> run(1, 0), order(self.size + 1);
+        for (size_type loc = 0; loc < self.size; ++loc)
+            run.push_back(std::lower_bound(kept.begin() + run.back(), kept.end(), self.key[loc], below) - kept.begin());
+        run.push_back(kept.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_type lhs, size_type rhs) { return run[lhs + 1] - run[lhs] > run[rhs + 1] - run[rhs]; });
+
+        Vec<bool> leaving(self.size + 1);
+        for (size_type i = 0, left = kept.size(); left > MESSAGE_BUFFER; ++i)
+            leaving[order[i]] = true, left -= run[order[i] + 1] - run[order[i]];
+        Vec<op> staying;
+        for (size_type loc = 0; loc <= self.size; ++loc)
+            std::move(kept.begin() + run[loc], kept.begin() + run[loc + 1], std::back_inserter(leaving[loc] ? down : staying));
+        kept = std::move(staying);
     }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::lower_bound(internal_node &self, const key_type &key) -> iterator {
-        size_type loc = std::upper_bound(self.key, self.key + self.size, key, key_le) - self.key;
-        if (self.subIsLeaf) {
-            leaf_node *v = static_cast<leaf_node*>(std::malloc(sizeof(leaf_node)));
-            self.sub[loc].load(file, *v);
-            auto tmp = lower_bound(*v, key);
-            std::free(v);
-            return tmp;
-        } else {
-            internal_node *v = static_cast<internal_node*>(std::malloc(sizeof(internal_node)));
-            self.sub[loc].load(file, *v);
-            auto tmp = lower_bound(*v, key);
-            std::free(v);
-            return tmp;
+    /* move the upper part of the full leaf v, child loc of self, into a fresh right sibling */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::split(internal_node &self, size_type loc, leaf_node &v, bool append) -> void {
+        size_type mid = splitPoint<leaf_node>(v.key, v.size, 0, append);
+        HardDisk::Record rec = leafNodePool.alloc(self.sub[loc]);
+        auto w = createNode<leaf_node>(rec);
+        std::move(v.key + mid, v.key + v.size, w->key);
+        std::move(v.rec + mid, v.rec + v.size, w->rec);
+        w->size = v.size - mid;
+        v.size = mid;
+
+        std::move_backward(self.key + loc,     self.key + self.size,     self.key + self.size + 1);
+        std::move_backward(self.sub + loc + 1, self.sub + self.size + 1, self.sub + self.size + 2);
+        if constexpr (TALLIED) {
+            std::move_backward(self.tally + loc + 1, self.tally + self.size + 1, self.tally + self.size + 2);
+            self.tally[loc] = tallyOf(v), self.tally[loc + 1] = tallyOf(*w);
+        }
+        self.key[loc] = separator(v.key[mid - 1], w->key[0]);
+        ++self.size;
+
+        w->left = self.sub[loc];
+        w->right = std::move(v.right);
+        self.sub[loc + 1] = rec;
+        w.dirty();
+
+        v.right = self.sub[loc + 1];
+        if (not w->right.empty()) {
+            auto t = pinNode<leaf_node>(w->right);
+            t->left = v.right;
+            t.dirty();
+        }
+    }
+
+    /* move the upper part of the full internal node v, child loc of self, into a fresh right
+     * sibling, the key between the parts goes up into self */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::split(internal_node &self, size_type loc, internal_node &v, bool append) -> void {
+        size_type mid = splitPoint<internal_node>(v.key, v.size, 1, append);
+        HardDisk::Record rec = internalNodePool.alloc(self.sub[loc]);
+        auto w = createNode<internal_node>(rec);
+        std::move(v.key + mid + 1, v.key + v.size,     w->key);
+        std::move(v.sub + mid + 1, v.sub + v.size + 1, w->sub);
+        if constexpr (TALLIED) std::move(v.tally + mid + 1, v.tally + v.size + 1, w->tally);
+        w->size = v.size - mid - 1;
+        v.size = mid;
+        w->subIsLeaf = v.subIsLeaf;
+
+        std::move_backward(self.key + loc,     self.key + self.size,     self.key + self.size + 1);
+        std::move_backward(self.sub + loc + 1, self.sub + self.size + 1, self.sub + self.size + 2);
+        if constexpr (TALLIED) {
+            std::move_backward(self.tally + loc + 1, self.tally + self.size + 1, self.tally + self.size + 2);
+            self.tally[loc] = tallyOf(v), self.tally[loc + 1] = tallyOf(*w);
+        }
+        self.key[loc] = std::move(v.key[mid]);
+        ++self.size;
+
+        self.sub[loc + 1] = rec;
+        w.dirty();
+    }
+
+    /* drop a leaf from the cache and give it back to its pool, it may have been the last one */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::freeLeaf(const HardDisk::Record &rec) -> void {
+        nodeCache.discard(rec);
+        leafNodePool.dealloc(rec);
+        if (rec.offset == lastLeaf.offset) lastLeaf = HardDisk::Record();
+    }
+
+    /* the leaf whose range covers key */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::locate(const key_type &key) -> HardDisk::Record {
+        const internal_node *u = root;
+        HardDisk::BufferPool::view<internal_node> h;
+        for ( ; ; ) {
+            size_type loc = key_upper(u->key, u->size, key);
+            if (u->subIsLeaf) return u->sub[loc];
+            h = nodeCache.template peek<internal_node>(u->sub[loc]);
+            u = h.get();
         }
     }
 
+    /* even out two neighbouring children of which at least one is scanty, key is the separator
+     * between them. returns whether rhs was merged into lhs and released */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::rebalance(bool subIsLeaf, key_type &key, const HardDisk::Record &lhs, const HardDisk::Record &rhs) -> bool {
+        if (subIsLeaf) {
+            auto v = pinNode<leaf_node>(lhs), w = pinNode<leaf_node>(rhs);
+            size_type total = v->size + w->size, size = total - total / 2;
+            /* whether the keys from lo to hi of both, taken together, fit into one leaf */
+            Vec<key_type> keys;
+            if constexpr (COMPRESSED) keys.assign(v->key, v->key + v->size), keys.insert(keys.end(), w->key, w->key + w->size);
+            auto fits = [&](size_type lo, size_type hi) { return fitting<leaf_node>(keys.data() + lo, hi - lo) == hi - lo; };
+
+            v.dirty();
+            if (total <= size_type(leaf_node::MAX_KEY_NUM) and (not COMPRESSED or fits(0, total))) {
+                std::move(w->key, w->key + w->size, v->key + v->size);
+                std::move(w->rec, w->rec + w->size, v->rec + v->size);
+                v->size += w->size;
+                v->right = w->right;
+                if (not v->right.empty()) {
+                    auto t = pinNode<leaf_node>(v->right);
+                    t->left = lhs;
+                    t.dirty();
+                }
+                freeLeaf(rhs);
+                return true;
+            }
+
+            if (COMPRESSED and not (fits(0, size) and fits(size, total))) return false;
+            if (v->size < size) {
+                size_type d = size - v->size;
+                std::move(w->key, w->key + d, v->key + v->size);
+                std::move(w->rec, w->rec + d, v->rec + v->size);
+                std::move(w->key + d, w->key + w->size, w->key);
+                std::move(w->rec + d, w->rec + w->size, w->rec);
+            } else {
+                size_type d = v->size - size;
+                std::move_backward(w->key, w->key + w->size, w->key + w->size + d);
+                std::move_backward(w->rec, w->rec + w->size, w->rec + w->size + d);
+                std::move(v->key + size, v->key + v->size, w->key);
+                std::move(v->rec + size, v->rec + v->size, w->rec);
+            }
+            v->size = size, w->size = total - size;
+            key = separator(v->key[size - 1], w->key[0]);
+            w.dirty();
+            return false;
+        }
+
+        auto v = pinNode<internal_node>(lhs), w = pinNode<internal_node>(rhs);
+        /* the writes both hold have to fit into either of them */
+        if constexpr (BUFFERED) if (v->pending + w->pending > 2 * MESSAGE_BUFFER) return false;
+        v.dirty();
+        Vec<key_type> keys(v->key, v->key + v->size);
+        Vec<HardDisk::Record> subs(v->sub, v->sub + v->size + 1);
+        keys.push_back(key);
+        keys.insert(keys.end(), w->key, w->key + w->size);
+        subs.insert(subs.end(), w->sub, w->sub + w->size + 1);
+        Vec<tally_type> tallies;
+        if constexpr (TALLIED) tallies.assign(v->tally, v->tally + v->size + 1), tallies.insert(tallies.end(), w->tally, w->tally + w->size + 1);
+        auto fits = [&](size_type lo, size_type hi) { return fitting<internal_node>(keys.data() + lo, hi - lo) == hi - lo; };
+
+        if (keys.size() <= size_type(internal_node::MAX_KEY_NUM) and fits(0, keys.size())) {
+            std::move(keys.begin() + v->size, keys.end(), v->key + v->size);
+            std::move(w->sub, w->sub + w->size + 1, v->sub + v->size + 1);
+            if constexpr (TALLIED) std::move(tallies.begin() + v->size + 1, tallies.end(), v->tally + v->size + 1);
+            v->size = keys.size();
+            if constexpr (BUFFERED) std::move(w->message, w->message + w->pending, v->message + v->pending), v->pending += w->pending;
+            nodeCache.discard(rhs);
+            internalNodePool.dealloc(rhs);
+            return true;
+        }
+
+        size_type total = subs.size(), size = total - total / 2;
+        if (not (fits(0, size - 1) and fits(size, keys.size()))) return false;
+        v->size = size - 1;
+        std::move(keys.begin(), keys.begin() + size - 1, v->key);
+        std::move(subs.begin(), subs.begin() + size,     v->sub);
+        key = keys[size - 1];
+        w->size = total - size - 1;
+        std::move(keys.begin() + size, keys.end(), w->key);
+        std::move(subs.begin() + size, subs.end(), w->sub);
+        if constexpr (TALLIED) {
+            std::move(tallies.begin(), tallies.begin() + size, v->tally);
+            std::move(tallies.begin() + size, tallies.end(), w->tally);
+        }
+        if constexpr (BUFFERED) {
+            Vec<op> held(v->message, v->message + v->pending);
+            held.insert(held.end(), w->message, w->message + w->pending);
+            size_type cut = std::lower_bound(held.begin(), held.end(), key, [this](const op &o, const key_type &k) { return key_le(o.key, k); }) - held.begin();
+            v->pending = cut, w->pending = held.size() - cut;
+            std::move(held.begin(), held.begin() + cut, v->message);
+            std::move(held.begin() + cut, held.end(), w->message);
+        }
+        w.dirty();
+        return false;
+    }
+
 /* } */
 
 /* impl btree<Key, Value, Compare, FACTOR> { */
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    bptree<Key, Value, Compare, FACTOR>::bptree(const std::string &filename) {
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    bptree<Key, Value, Compare, FACTOR, Traits>::bptree(const std::string &filename, size_type cacheBytes): fileName(filename), nodeCache(file, cacheBytes), valueHeap(file, nodeCache) {
+        static_assert(PAGE_BYTES == 0 or COMPRESSED or (sizeof(leaf_node) <= PAGE_BYTES and sizeof(internal_node) <= PAGE_BYTES), "bptree nodes outgrew PAGE_BYTES");
         root = new internal_node;
-        if (file.open(filename)) {
-            file.read(header);
+        bool existing = file.open(filename);
+
+        /* an interrupted checkpoint is finished before anything is read, the writes logged since
+         * the last complete one are redone once the tree is loaded */
+        Vec<op> redo;
+        if constexpr (LOGGED) {
+            wal = std::make_unique<HardDisk::WriteAheadLog>(filename + ".wal", Traits::LOG_SYNC);
+            existing |= wal->replay(
+                [this](HardDisk::Record::offset_type offset, std::span<const std::byte> bytes) { file.write_bytes(offset, bytes); },
+                [&redo](std::span<const std::byte> bytes) { std::memcpy(std::addressof(redo.emplace_back()), bytes.data(), sizeof(op)); });
+            nodeCache.keep_dirty(true);
+            dataPool.hold(true);
+            leafNodePool.hold(true);
+            internalNodePool.hold(true);
+        }
+
+        /* lookups jump all over the file, readahead would only evict useful pages */
+        file.advise(HardDisk::access::random);
+        if (existing) {
+            file.read_at(0, header);
             header.root.load(file, *root);
+            if (not header.freeSpace.empty()) {
+                file.seek(header.freeSpace.offset);
+                dataPool.restore(file);
+                leafNodePool.restore(file);
+                internalNodePool.restore(file);
+                if constexpr (VARIABLE_VALUE) valueHeap.restore(file);
+            }
+            if (FILTERED and not header.filterSpace.empty()) {
+                file.seek(header.filterSpace.offset);
+                filter.restore(file);
+            }
         } else {
             header.root = HardDisk::Record(sizeof(header));
-            root->sub[0] = HardDisk::Record(sizeof(header) + sizeof(internal_node));
+            root->sub[0] = HardDisk::Record(alignUp(sizeof(header) + HardDisk::file_bytes<internal_node>(), NODE_ALIGNMENT));
             root->subIsLeaf = true;
             file.write(header);
             header.root.save(file, *root);
             root->sub[0].save(file, leaf_node());
         }
+        /* a file written without the filter, or with another size of it, gets it built now */
+        if (FILTERED and filter.bits_per_key() != Traits::BLOOM_BITS_PER_KEY) tendFilter();
+
+        if constexpr (LOGGED) {
+            auto log = std::move(wal);
+            apply_batch(redo);
+            wal = std::move(log);
+            flush();
+        }
     }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    bptree<Key, Value, Compare, FACTOR>::~bptree() {
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    bptree<Key, Value, Compare, FACTOR, Traits>::~bptree() {
+        flush();
         delete root;
     }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::insert(const key_type &key, const value_type &value) -> std::pair<iterator, bool> {
-        auto result = insert(*root, key, value);
-        if (result.first.second) {
-            header.root.save(file, *root);
-            root->size = 0;
-            root->sub[0] = header.root;
-            root->subIsLeaf = false;
-            header.root = internalNodePool.alloc().save(file, *root);
-            file.seek(0);
-            file.write(header);
-        } return std::make_pair(result.first.first, result.second);
+    /* write back every cached node together with the root, the free lists and the filter, so the
+     * file can be reopened. the free list and filter regions are rewritten in place while they are
+     * large enough, otherwise they move to the end of the file with room to double; the old region
+     * is given up.
+     * in logged mode this is a checkpoint: everything about to be overwritten is logged and
+     * sealed first, and the log is dropped once the file is synced */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::flush() -> void {
+        std::unique_lock<std::shared_mutex> quiet;
+        if constexpr (CONCURRENT and LOGGED) quiet = std::unique_lock(checkpointLock);
+        if constexpr (LOGGED) {
+            dataPool.release_held();
+            leafNodePool.release_held();
+            internalNodePool.release_held();
+        }
+
+        auto place = [this](HardDisk::Record &region, size_type &room, size_type bytes) {
+            if (bytes <= room) return;
+            room = 2 * bytes;
+            region = HardDisk::Record(file.size());
+            file.write_bytes(region.offset, Vec<std::byte>(room));
+        };
+
+        Vec<std::byte> freeLists, filterBits;
+        dataPool.dump(freeLists);
+        leafNodePool.dump(freeLists);
+        internalNodePool.dump(freeLists);
+        if constexpr (VARIABLE_VALUE) valueHeap.dump(freeLists);
+        place(header.freeSpace, header.freeSpaceBytes, freeLists.size());
+        if constexpr (FILTERED) {
+            tendFilter();
+            filter.dump(filterBits);
+            place(header.filterSpace, header.filterSpaceBytes, filterBits.size());
+        }
+
+        if constexpr (LOGGED) {
+            /* values are written straight to fresh records, the images may point at them */
+            file.sync();
+            nodeCache.for_each_dirty([this](HardDisk::Record::offset_type offset, std::span<const std::byte> bytes) { wal->log_image(offset, bytes); });
+            Vec<std::byte> rootImage;
+            wal->log_image(header.root.offset, HardDisk::image(*root, rootImage));
+            wal->log_image(header.freeSpace.offset, freeLists);
+            if constexpr (FILTERED) wal->log_image(header.filterSpace.offset, filterBits);
+            wal->log_image(0, std::as_bytes(std::span(std::addressof(header), 1)));
+            wal->log_seal();
+        }
+
+        nodeCache.flush();
+        header.root.save(file, *root);
+        file.write_bytes(header.freeSpace.offset, freeLists);
+        if constexpr (FILTERED) file.write_bytes(header.filterSpace.offset, filterBits);
+        file.write_at(0, header);
+
+        if constexpr (LOGGED) {
+            file.sync();
+            wal->truncate();
+        } else file.flush();
+    }
+
+    /* held by every write in concurrent logged mode, so that a checkpoint sees no write half done */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::writing() -> std::shared_lock<std::shared_mutex> {
+        if constexpr (CONCURRENT and LOGGED) return std::shared_lock(checkpointLock);
+        else return {};
+    }
+
+    /* returns the position to commit, 0 if nothing was logged */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::logOp(typename op::type_t type, const key_type &key, const value_type &value) -> u64 {
+        if (wal == nullptr) return 0;
+        op o{ type, key, value };
+        return wal->append(std::as_bytes(std::span(std::addressof(o), 1)));
+    }
+
+    /* wait for the log as the sync policy says, and checkpoint once the dirty nodes no longer fit
+     * into the cache. must be called with no node latched */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::commit(u64 lsn) -> void {
+        if constexpr (LOGGED) {
+            if (wal == nullptr) return;
+            if (lsn != 0) wal->commit(lsn);
+            if (nodeCache.overfull()) flush();
+        }
+    }
+
+    /* rebuild the filter once it is stale: sized for twice the keys it should hold, every key of
+     * the leaves is put in, left to right. sized again if the count it went by was off */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::tendFilter() -> void {
+        if constexpr (FILTERED) {
+            while (filter.stale() or filter.bits_per_key() != Traits::BLOOM_BITS_PER_KEY) {
+                filter.build(2 * filter.keys(), Traits::BLOOM_BITS_PER_KEY);
+                HardDisk::Record rec = root->sub[0];
+                for (bool subIsLeaf = root->subIsLeaf; not subIsLeaf; ) {
+                    auto u = nodeCache.template peek<internal_node>(rec);
+                    subIsLeaf = u->subIsLeaf;
+                    rec = u->sub[0];
+                }
+                while (not rec.empty()) {
+                    auto u = nodeCache.template peek<leaf_node>(rec);
+                    for (size_type i = 0; i < u->size; ++i) filterAdd(u->key[i]);
+                    rec = u->right;
+                }
+            }
+        }
+    }
+
+    /* push the root, which took a key, down under a fresh one */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::growRoot() -> void {
+        auto v = createNode<internal_node>(header.root);
+        *v = *root;
+        v.dirty();
+        root->size = 0;
+        if constexpr (BUFFERED) root->pending = 0;
+        if constexpr (TALLIED) root->tally[0] = tallyOf(*v);
+        root->sub[0] = header.root;
+        root->subIsLeaf = false;
+        header.root = internalNodePool.alloc(header.root).save(file, *root);
+        if constexpr (not LOGGED) file.write_at(0, header);
+    }
+
+    /* value() in write-optimized mode. the writes held on the way down are the newer the higher up
+     * they are held: the first erase or upsert met decides, an insert only does if the key is
+     * absent further down, and then the lowest insert above it wins */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::lookup(const key_type &key) -> std::optional<value_type> {
+        std::optional<value_type> inserted;
+        const internal_node *u = root;
+        HardDisk::BufferPool::view<internal_node> h;
+        for ( ; ; ) {
+            const op *end = u->message + u->pending;
+            const op *at = std::lower_bound(u->message, end, key, [this](const op &lhs, const key_type &rhs) { return key_le(lhs.key, rhs); });
+            if (at != end and key_eq(at->key, key)) {
+                if (at->type == op::erase) return inserted;
+                if (at->type == op::upsert) return at->value;
+                inserted = at->value;
+            }
+            size_type loc = key_upper(u->key, u->size, key);
+            if (u->subIsLeaf) {
+                auto leaf = nodeCache.template peek<leaf_node>(u->sub[loc]);
+                size_type i = key_lower(leaf->key, leaf->size, key);
+                if (i < leaf->size and key_eq(key, leaf->key[i])) return loadSlot(leaf->rec[i]);
+                return inserted;
+            }
+            h = nodeCache.template peek<internal_node>(u->sub[loc]);
+            u = h.get();
+        }
+    }
+
+    /* a key s with lhs < s <= rhs to tell two neighbouring nodes apart. with compressed keys it is
+     * rhs cut off after the first byte it differs from lhs in, as long as that still orders right */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::separator(const key_type &lhs, const key_type &rhs) const -> key_type {
+        if constexpr (COMPRESSED) {
+            const std::byte *l = keyBytes(lhs), *r = keyBytes(rhs);
+            size_type used = std::mismatch(l, l + KEY_BYTES, r).first - l + 1;
+            if (used < KEY_BYTES) {
+                key_type s = rhs;
+                std::memset(reinterpret_cast<std::byte*>(std::addressof(s)) + used, 0, KEY_BYTES - used);
+                if (key_le(lhs, s) and not key_le(rhs, s)) return s;
+            }
+        } return rhs;
+    }
+
+    /* the locks a write that may split or merge nodes holds for its whole duration */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::exclusive() -> std::pair<std::unique_lock<std::mutex>, std::unique_lock<HardDisk::Latch>> {
+        if constexpr (CONCURRENT) {
+            std::unique_lock structure(structureLock);
+            return std::make_pair(std::move(structure), std::unique_lock(rootLatch));
+        } else return {};
+    }
+
+    /* optimistic descent for concurrent mode: the leaf covering key, pinned but not latched,
+     * together with its record and the version it was reached at. every node is validated after
+     * its child has been pinned, and the descent starts over if one of them changed */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::descend(const key_type &key) -> std::tuple<HardDisk::BufferPool::handle<leaf_node>, HardDisk::Record, u64> {
+        for ( ; ; ) {
+            const internal_node *u = root;
+            const HardDisk::Latch *latch = std::addressof(rootLatch);
+            HardDisk::BufferPool::handle<internal_node> h;
+            for (u64 version = latch->read(); ; ) {
+                size_type size = std::min<size_type>(u->size, internal_node::MAX_KEY_NUM + 1);
+                size_type loc = key_upper(u->key, size, key);
+                HardDisk::Record next = u->sub[loc];
+                bool subIsLeaf = u->subIsLeaf;
+                if (not latch->validate(version)) break;
+
+                if (subIsLeaf) {
+                    auto v = nodeCache.template pin<leaf_node>(next);
+                    u64 leafVersion = v.latch().read();
+                    if (not latch->validate(version)) break;
+                    return std::make_tuple(std::move(v), next, leafVersion);
+                }
+                auto v = nodeCache.template pin<internal_node>(next);
+                u64 childVersion = v.latch().read();
+                if (not latch->validate(version)) break;
+                h = std::move(v), u = h.get(), latch = std::addressof(h.latch()), version = childVersion;
+            }
+        }
     }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::erase(const key_type &key) -> bool { return erase(*root, key).second; }
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::insert(const key_type &key, const value_type &value) -> std::pair<iterator, bool> {
+        /* the iterator needs the key in its leaf, the insert is taken all the way down */
+        if constexpr (BUFFERED) {
+            if (lookup(key)) return std::make_pair(find(key), false);
+            op o{ op::insert, key, value };
+            deliver(std::span(std::addressof(o), 1), delivery::pull, std::span(std::addressof(key), 1));
+            return std::make_pair(find(*root, key), true);
+        }
+        u64 lsn = 0;
+        auto result = [&]() -> std::pair<iterator, bool> {
+            auto quiet = writing();
+            if constexpr (CONCURRENT) {
+                for ( ; ; ) {
+                    auto [leaf, rec, version] = descend(key);
+                    if (not leaf.upgrade(version)) continue;
+                    size_type loc = key_lower(leaf->key, leaf->size, key);
+                    if (loc < leaf->size and key_eq(key, leaf->key[loc]))
+                        return std::make_pair(iterator(this, rec, *leaf, loc), false);
+                    if (not leaf->room(key)) break;
+                    leaf.dirty();
+                    lsn = logOp(op::insert, key, value);
+                    return insert(*leaf, rec, key, value).first;
+                }
+            }
+
+            /* an append that fits into the last leaf needs no descent; the tallies above it would */
+            if constexpr (not (CONCURRENT or TALLIED)) if (not lastLeaf.empty()) {
+                auto leaf = pinNode<leaf_node>(lastLeaf);
+                if (leaf->right.empty() and leaf->size > 0 and key_le(leaf->key[leaf->size - 1], key) and leaf->room(key)) {
+                    leaf.dirty();
+                    lsn = logOp(op::insert, key, value);
+                    return insert(*leaf, lastLeaf, key, value).first;
+                }
+            }
+
+            auto guard = exclusive();
+            auto inserted = insert(*root, key, value);
+            if (inserted.first.second) growRoot();
+            if (inserted.second) lsn = logOp(op::insert, key, value);
+            if constexpr (not CONCURRENT) if (inserted.first.first.self.right.empty()) lastLeaf = inserted.first.first.node;
+            return std::make_pair(inserted.first.first, inserted.second);
+        }();
+        commit(lsn);
+        if constexpr (not CONCURRENT) if (result.second) tendFilter();
+        return result;
+    }
+
+    /* insert(), or give the key already there value in place. the bool is whether key was
+     * inserted */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::insert_or_assign(const key_type &key, const value_type &value) -> std::pair<iterator, bool> {
+        if constexpr (BUFFERED) {
+            bool fresh = not lookup(key);
+            op o{ op::upsert, key, value };
+            deliver(std::span(std::addressof(o), 1), delivery::pull, std::span(std::addressof(key), 1));
+            return std::make_pair(find(*root, key), fresh);
+        }
+        u64 lsn = 0;
+        auto result = [&]() -> std::pair<iterator, bool> {
+            auto quiet = writing();
+            if constexpr (CONCURRENT) {
+                for ( ; ; ) {
+                    auto [leaf, rec, version] = descend(key);
+                    if (not leaf.upgrade(version)) continue;
+                    size_type loc = key_lower(leaf->key, leaf->size, key);
+                    if (loc < leaf->size and key_eq(key, leaf->key[loc])) {
+                        leaf.dirty();
+                        lsn = store(*leaf, rec, loc, value);
+                        return std::make_pair(iterator(this, rec, *leaf, loc), false);
+                    }
+                    if (not leaf->room(key)) break;
+                    leaf.dirty();
+                    lsn = logOp(op::insert, key, value);
+                    return insert(*leaf, rec, key, value).first;
+                }
+            }
+
+            auto guard = exclusive();
+            auto inserted = insert(*root, key, value);
+            if (inserted.first.second) growRoot();
+            iterator it = inserted.first.first;
+            if (inserted.second) lsn = logOp(op::insert, key, value);
+            else {
+                /* insert() stopped at the key, its leaf is still cached */
+                auto leaf = pinNode<leaf_node>(it.node);
+                lsn = store(*leaf, it.node, it.loc, value);
+                if constexpr (INLINE_VALUE or LOGGED or VARIABLE_VALUE) leaf.dirty();
+                it.self = *leaf;
+            }
+            return std::make_pair(it, inserted.second);
+        }();
+        commit(lsn);
+        if constexpr (not CONCURRENT) if (result.second) tendFilter();
+        return result;
+    }
+
+    /* call fn with the value of key as a value_type& and write back what it leaves there, with a
+     * single descent and no write at all if the value compares equal afterwards. returns whether
+     * key was there */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    template <typename Fn>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::update(const key_type &key, Fn fn) -> bool {
+        if (absent(key)) return false;
+        if constexpr (BUFFERED) {
+            auto found = lookup(key);
+            if (not found) return false;
+            value_type value = *found;
+            fn(value);
+            if (not same(value, *found)) post(op{ op::upsert, key, value });
+            return true;
+        }
+        u64 lsn = 0;
+        bool found = [&] {
+            auto quiet = writing();
+            /* the value changes in place, the leaf latch is all a concurrent tree needs */
+            for ( ; ; ) {
+                auto [leaf, rec, version] = [&] {
+                    if constexpr (CONCURRENT) return descend(key);
+                    else { HardDisk::Record at = locate(key); return std::make_tuple(pinNode<leaf_node>(at), at, u64(0)); }
+                }();
+                if constexpr (CONCURRENT) if (not leaf.upgrade(version)) continue;
+                size_type loc = key_lower(leaf->key, leaf->size, key);
+                if (loc == leaf->size or not key_eq(key, leaf->key[loc])) return false;
+                value_type old = loadSlot(leaf->rec[loc]), value = old;
+                fn(value);
+                if (same(value, old)) return true;
+                if constexpr (CONCURRENT or INLINE_VALUE or LOGGED or VARIABLE_VALUE) leaf.dirty();
+                lsn = store(*leaf, rec, loc, value);
+                return true;
+            }
+        }();
+        commit(lsn);
+        return found;
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::erase(const key_type &key) -> bool {
+        if constexpr (BUFFERED) {
+            if (not lookup(key)) return false;
+            post(op{ op::erase, key, value_type() });
+            return true;
+        }
+        u64 lsn = 0;
+        bool done = [&] {
+            auto quiet = writing();
+            if constexpr (CONCURRENT) {
+                for ( ; ; ) {
+                    auto [leaf, rec, version] = descend(key);
+                    if (not leaf.upgrade(version)) continue;
+                    if (not leaf->surplus()) break;
+                    bool erased = erase(*leaf, key).first;
+                    if (erased) leaf.dirty(), lsn = logOp(op::erase, key, value_type());
+                    return erased;
+                }
+            }
+
+            auto guard = exclusive();
+            bool erased = erase(*root, key).second;
+            if (root->size > 0) growRoot();
+            if (erased) lsn = logOp(op::erase, key, value_type());
+            return erased;
+        }();
+        commit(lsn);
+        if constexpr (not CONCURRENT) if (done) tendFilter();
+        return done;
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::find(const key_type &key) -> iterator {
+        if (absent(key)) return end();
+        if constexpr (BUFFERED) deliver({}, delivery::pull, std::span(std::addressof(key), 1));
+        if constexpr (CONCURRENT) {
+            for ( ; ; ) {
+                auto [leaf, rec, version] = descend(key);
+                size_type size = std::min<size_type>(leaf->size, leaf_node::MAX_KEY_NUM + 1);
+                size_type loc = key_lower(leaf->key, size, key);
+                iterator result = loc < size and key_eq(key, leaf->key[loc]) ? iterator(this, rec, *leaf, loc) : end();
+                if (leaf.latch().validate(version)) return result;
+            }
+        } else return find(*root, key);
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::value(const key_type &key) -> value_type {
+        if (absent(key)) return value_type();
+        if constexpr (BUFFERED) return lookup(key).value_or(value_type());
+        if constexpr (CONCURRENT) {
+            for ( ; ; ) {
+                auto [leaf, rec, version] = descend(key);
+                size_type size = std::min<size_type>(leaf->size, leaf_node::MAX_KEY_NUM + 1);
+                size_type loc = key_lower(leaf->key, size, key);
+                bool found = loc < size and key_eq(key, leaf->key[loc]);
+                slot_type slot = found ? leaf->rec[loc] : slot_type();
+                if (not leaf.latch().validate(version)) continue;
+                if (not found) return value_type();
+
+                /* an out of line value may be released and reused once the leaf changes */
+                value_type result = loadSlot(slot);
+                if (leaf.latch().validate(version)) return result;
+            }
+        } else return value(*root, key);
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::lower_bound(const key_type &key) -> iterator {
+        drain();
+        if constexpr (CONCURRENT) {
+            for ( ; ; ) {
+                auto [leaf, rec, version] = descend(key);
+                size_type size = std::min<size_type>(leaf->size, leaf_node::MAX_KEY_NUM + 1);
+                size_type loc = key_lower(leaf->key, size, key);
+                if (loc < size) {
+                    iterator result(this, rec, *leaf, loc);
+                    if (leaf.latch().validate(version)) return result;
+                    continue;
+                }
+
+                /* every key of the leaf is smaller, the answer is the first one of its right sibling */
+                HardDisk::Record right = leaf->right;
+                if (not leaf.latch().validate(version)) continue;
+                if (right.empty()) return end();
+                auto next = nodeCache.template pin<leaf_node>(right);
+                u64 nextVersion = next.latch().read();
+                if (not leaf.latch().validate(version)) continue;
+                iterator result(this, right, *next, 0);
+                if (next.latch().validate(nextVersion) and 0 < next->size) return result;
+            }
+        } else return lower_bound(*root, key);
+    }
+
+    /* value() for many keys at once. the keys are sorted and descend together, one level at a
+     * time; the nodes of a level that are not cached, and then the out of line values, are read
+     * as one batch so that the reads are in flight side by side. a concurrent or write-optimized
+     * tree looks the keys up one by one */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::multi_get(std::span<const key_type> keys) -> Vec<value_type> {
+        Vec<value_type> result(keys.size());
+        if constexpr (CONCURRENT or BUFFERED) {
+            for (size_type i = 0; i < keys.size(); ++i) result[i] = value(keys[i]);
+        } else {
+            /* keys the filter rules out keep their default value */
+            Vec<size_type> order;
+            order.reserve(keys.size());
+            for (size_type i = 0; i < keys.size(); ++i)
+                if (not absent(keys[i])) order.push_back(i);
+            std::sort(order.begin(), order.end(), [&](size_type lhs, size_type rhs) { return key_le(keys[lhs], keys[rhs]); });
+
+            /* a batch at a time, its leaves stay pinned until its values are read */
+            for (size_type first = 0; first < order.size(); first += MULTI_GET_BATCH) {
+                std::span<const size_type> batch(order.data() + first, std::min(MULTI_GET_BATCH, order.size() - first));
+                Vec<HardDisk::Record> next(batch.size()), recs;
+                Vec<size_type> which(batch.size());
+                auto route = [&](const internal_node &u, size_type i) {
+                    next[i] = u.sub[key_upper(u.key, u.size, keys[batch[i]])];
+                };
+                /* sorted keys reach every node in one run, so equal children are adjacent */
+                auto group = [&] {
+                    recs.clear();
+                    for (size_type i = 0; i < batch.size(); ++i) {
+                        if (recs.empty() or recs.back().offset != next[i].offset) recs.push_back(next[i]);
+                        which[i] = recs.size() - 1;
+                    }
+                };
+
+                for (size_type i = 0; i < batch.size(); ++i) route(*root, i);
+                for (bool subIsLeaf = root->subIsLeaf; not subIsLeaf; ) {
+                    group();
+                    auto nodes = nodeCache.template pin_batch<internal_node>(recs);
+                    subIsLeaf = nodes.front()->subIsLeaf;
+                    for (size_type i = 0; i < batch.size(); ++i) route(*nodes[which[i]], i);
+                }
+
+                group();
+                auto leaves = nodeCache.template pin_batch<leaf_node>(recs);
+                Vec<HardDisk::read_request> reads;
+                for (size_type i = 0; i < batch.size(); ++i) {
+                    const leaf_node &u = *leaves[which[i]];
+                    const key_type &key = keys[batch[i]];
+                    size_type loc = key_lower(u.key, u.size, key);
+                    if (loc == u.size or not key_eq(key, u.key[loc])) continue;
+                    if constexpr (INLINE_VALUE or VARIABLE_VALUE) result[batch[i]] = loadSlot(u.rec[loc]);
+                    else reads.push_back({ u.rec[loc].offset, std::as_writable_bytes(std::span(std::addressof(result[batch[i]]), 1)) });
+                }
+                if constexpr (not INLINE_VALUE and not VARIABLE_VALUE) file.read_batch(reads);
+            }
+        } return result;
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::makeSlot(const value_type &value, const HardDisk::Record &hint) -> slot_type {
+        if constexpr (INLINE_VALUE) return std::bit_cast<value_bytes>(value);
+        else if constexpr (VARIABLE_VALUE) return valueHeap.put(HardDisk::bytes_of(value));
+        else return dataPool.alloc(hint).save(file, value);
+    }
+
+    /* write value over the one in slot loc of the leaf u at rec, which the caller has pinned and
+     * marks dirty if the slot lives in it. returns the lsn of the write */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::store(leaf_node &u, const HardDisk::Record &rec, size_type loc, const value_type &value) -> u64 {
+        saveSlot(u.rec[loc], value, rec);
+        if constexpr (AGGREGATED) retally(*root, u.key[loc]);
+        return logOp(op::upsert, u.key[loc], value);
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::loadSlot(const slot_type &slot) -> value_type {
+        if constexpr (INLINE_VALUE) return std::bit_cast<value_type>(slot);
+        else if constexpr (VARIABLE_VALUE) {
+            /* a concurrent reader may come by a released slot, it finds out once it validates */
+            Vec<std::byte> bytes;
+            if (not valueHeap.get(slot, bytes)) return value_type();
+            return HardDisk::from_bytes<value_type>(bytes);
+        } else return slot.template get<value_type>(file);
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::saveSlot(slot_type &slot, const value_type &value, const HardDisk::Record &hint) -> void {
+        if constexpr (INLINE_VALUE) slot = std::bit_cast<value_bytes>(value);
+        else if constexpr (VARIABLE_VALUE) valueHeap.replace(slot, HardDisk::bytes_of(value));
+        /* the old record may belong to the last checkpoint */
+        else if constexpr (LOGGED) dropSlot(slot), slot = makeSlot(value, hint);
+        else slot.save(file, value);
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::dropSlot(const slot_type &slot) -> void {
+        if constexpr (VARIABLE_VALUE) valueHeap.erase(slot);
+        else if constexpr (not INLINE_VALUE) dataPool.dealloc(slot);
+    }
+
+    /* build the tree bottom-up from (key, value) pairs sorted by key: every leaf is appended
+     * together with its values (unless they are inlined), filled up to fill * MAX_KEY_NUM entries
+     * (fill of its page when keys are compressed), then the internal levels are
+     * appended on top of them one level at a time. on a non-empty tree this degrades to inserting
+     * the pairs one by one. returns the number of pairs inserted */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    template <typename InputIt>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::bulk_load(InputIt first, InputIt last, f64 fill) -> size_type {
+        drain();
+        if (not root->subIsLeaf or root->size != 0 or nodeCache.template pin<leaf_node>(root->sub[0])->size != 0) {
+            size_type count = 0;
+            for (; first != last; ++first)
+                count += insert(first->first, first->second).second;
+            return count;
+        }
+
+        HardDisk::Record empty = root->sub[0];
+        size_type count = build(first, last, fill);
+        if (count == 0) return 0;
+        freeLeaf(empty);
+        tendFilter();
+        /* nothing of it was logged, the file has to take it in at once */
+        if constexpr (LOGGED) flush();
+        return count;
+    }
+
+    /* append the leaves and internal levels for the sorted pairs to the file as bulk_load() lays
+     * them out, then hang them under the root in place of what it had. returns the number of
+     * pairs, nothing is built for none */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    template <typename InputIt>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::build(InputIt first, InputIt last, f64 fill) -> size_type {
+        const size_type leafFill = std::clamp(i32(leaf_node::MAX_KEY_NUM * fill), leaf_node::MIN_KEY_NUM + 1, leaf_node::MAX_KEY_NUM);
+        const size_type nodeFill = std::clamp(i32(internal_node::MAX_SUB_NUM * fill), internal_node::MIN_KEY_NUM + 2, internal_node::MAX_SUB_NUM);
+
+        /* separator in front of and record of every node of the level being built, and its size */
+        Vec<std::pair<key_type, HardDisk::Record>> level;
+        Vec<tally_type> tallies;
+        Vec<key_type> keys;
+        Vec<value_type> vals;
+        key_type lastKey{};
+        size_type count = 0;
+        /* the place taken for the next leaf, when its values go to the value heap */
+        HardDisk::Record next;
+
+        /* leaf i is followed by its own values, so the right sibling of a leaf is known as soon as
+         * its size is; the last two leaves are held back to even them out at the end of input.
+         * the value heap appends pages of its own as it fills up, so with variable values the place
+         * of the next leaf is taken right after the values of this one went in */
+        auto emitLeaf = [&](size_type size, bool rightmost) {
+            leaf_node *u = new (std::malloc(sizeof(leaf_node))) leaf_node();
+            HardDisk::Record::offset_type offset, valueOffset = 0;
+            u->size = size;
+            if (not level.empty()) u->left = level.back().second;
+            std::move(keys.begin(), keys.begin() + size, u->key);
+            if constexpr (VARIABLE_VALUE) {
+                if (next.empty()) next = HardDisk::Record().save(file, leaf_node());
+                offset = next.offset;
+                for (size_type i = 0; i < size; ++i) u->rec[i] = makeSlot(vals[i], HardDisk::Record());
+                if (not rightmost) u->right = next = HardDisk::Record().save(file, leaf_node());
+            } else {
+                file.seek(-1);
+                offset = alignUp(file.tell(), NODE_ALIGNMENT);
+                valueOffset = offset + alignUp(HardDisk::file_bytes<leaf_node>(), NODE_ALIGNMENT);
+                size_type valueBytes = INLINE_VALUE ? 0 : size * sizeof(value_type);
+                if (not rightmost) u->right = HardDisk::Record(alignUp(valueOffset + valueBytes, NODE_ALIGNMENT));
+            }
+            if constexpr (INLINE_VALUE)
+                std::transform(vals.begin(), vals.begin() + size, u->rec, [](const value_type &value) { return std::bit_cast<value_bytes>(value); });
+            else if constexpr (not VARIABLE_VALUE) for (size_type i = 0; i < size; ++i)
+                u->rec[i] = HardDisk::Record(valueOffset + i * sizeof(value_type));
+            HardDisk::Record(offset).save(file, *u);
+            if constexpr (not INLINE_VALUE and not VARIABLE_VALUE) {
+                file.seek(valueOffset);
+                for (size_type i = 0; i < size; ++i) file.write(vals[i]);
+            }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::find(const key_type &key) -> iterator { return find(*root, key); }
+            for (size_type i = 0; i < size; ++i) filterAdd(u->key[i]);
+            level.emplace_back(level.empty() ? u->key[0] : separator(lastKey, u->key[0]), HardDisk::Record(offset));
+            if constexpr (TALLIED) tallies.push_back(tallyOf(*u));
+            lastKey = u->key[size - 1];
+            keys.erase(keys.begin(), keys.begin() + size);
+            vals.erase(vals.begin(), vals.begin() + size);
+            std::free(u);
+        };
+
+        /* compressed keys fill a leaf by the bytes they take, not by their number */
+        auto leafSize = [&]() -> size_type {
+            if constexpr (COMPRESSED) {
+                size_type most = fitting<leaf_node>(keys.data(), keys.size());
+                return std::clamp<size_type>(most * fill, std::min<size_type>(leaf_node::MIN_KEY_NUM + 1, most), most);
+            } else return leafFill;
+        };
+
+        for (; first != last; ++first) {
+            if (not keys.empty() and not key_le(keys.back(), first->first)) {
+                if (key_le(first->first, keys.back())) throw "in bptree::bulk_load(): input is not sorted";
+                continue;
+            }
+            keys.push_back(first->first);
+            vals.push_back(first->second);
+            ++count;
+            if (keys.size() > 2 * leafFill) emitLeaf(leafSize(), false);
+        }
+        if (count == 0) return 0;
+        for ( ; ; ) {
+            size_type size = fitting<leaf_node>(keys.data(), keys.size());
+            if (size == keys.size()) break;
+            emitLeaf(std::min(size, keys.size() - keys.size() / 2), false);
+        }
+        emitLeaf(keys.size(), true);
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::value(const key_type &key) -> value_type { return value(*root, key); }
+        auto guard = exclusive();
+        stack(std::move(level), std::move(tallies), true, nodeFill);
+        return count;
+    }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::lower_bound(const key_type &key) -> iterator { return lower_bound(*root, key); }
+    /* rewrite the tree in key order at the end of the file: every leaf followed by its values, as
+     * bulk_load() lays them out, so that a scan reads the file front to back again. the copy is
+     * read off a cursor and only replaces the tree once it is complete, lookups may go on until
+     * then but writes must wait. the old nodes and values go back to their pools, where the
+     * writes after it find them */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::compact(f64 fill) -> void {
+        drain();
+        /* the leaf at the left or right end of the tree */
+        auto edge = [this](bool right) {
+            HardDisk::Record rec = root->sub[right ? root->size : 0];
+            for (bool subIsLeaf = root->subIsLeaf; not subIsLeaf; ) {
+                auto u = nodeCache.template peek<internal_node>(rec);
+                subIsLeaf = u->subIsLeaf;
+                rec = u->sub[right ? u->size : 0];
+            }
+            return nodeCache.template peek<leaf_node>(rec);
+        };
+        key_type lo, hi;
+        {
+            auto u = edge(false), v = edge(true);
+            if (u->size == 0) return;
+            lo = u->key[0], hi = v->key[v->size - 1];
+        }
+
+        /* the entries of the cursor one at a time, as build() takes them */
+        struct entries {
+            cursor *from;
+            std::span<const typename cursor::entry_type> page;
+            size_type at = 0;
+            auto operator -> () const -> const typename cursor::entry_type* { return std::addressof(page[at]); }
+            auto operator ++ () -> entries& {
+                if (++at == page.size()) page = from->next(), at = 0;
+                return *this;
+            }
+            auto operator != (const entries &) const -> bool { return not page.empty(); }
+        };
+        auto old = std::make_unique<internal_node>(*root);
+        {
+            cursor c(this, lo, hi, false, 8);
+            entries first{ std::addressof(c), c.next() };
+            build(first, entries{ nullptr, {} }, fill);
+        }
+        {
+            auto guard = exclusive();
+            release(*old);
+        }
+        tendFilter();
+        flush();
+    }
+
+    /* give the children of self, the nodes under them and the values in their leaves back to
+     * their pools */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::release(const internal_node &self) -> void {
+        for (size_type loc = 0; loc <= self.size; ++loc) {
+            if (self.subIsLeaf) {
+                {
+                    auto v = pinNode<leaf_node>(self.sub[loc]);
+                    for (size_type i = 0; i < v->size; ++i) dropSlot(v->rec[i]), filterErase();
+                }
+                freeLeaf(self.sub[loc]);
+            } else {
+                release(*pinNode<internal_node>(self.sub[loc]));
+                nodeCache.discard(self.sub[loc]);
+                internalNodePool.dealloc(self.sub[loc]);
+            }
+        }
+    }
+
+    /* append internal levels above the given nodes, nodeFill children apiece, until a single node
+     * is left, and hang that node under the root. tallies are those of the nodes when they are
+     * kept */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::stack(Vec<std::pair<key_type, HardDisk::Record>> level, Vec<tally_type> tallies, bool subIsLeaf, size_type nodeFill) -> void {
+        for (; level.size() > 1; subIsLeaf = false) {
+            Vec<std::pair<key_type, HardDisk::Record>> upper;
+            Vec<tally_type> upperTallies;
+            Vec<key_type> keys;
+            if constexpr (COMPRESSED) for (auto &entry: level) keys.push_back(entry.first);
+            internal_node *u = new (std::malloc(sizeof(internal_node))) internal_node();
+            for (size_type i = 0, rest = level.size(); rest > 0; ) {
+                size_type size = rest <= size_type(internal_node::MAX_SUB_NUM) ? rest
+                               : rest < 2 * nodeFill ? rest - rest / 2 : nodeFill;
+                if constexpr (COMPRESSED) size = fitting<internal_node>(keys.data() + i + 1, size - 1) + 1;
+                u->subIsLeaf = subIsLeaf;
+                u->size = size - 1;
+                for (size_type j = 0; j < size; ++j) {
+                    if (j > 0) u->key[j - 1] = level[i + j].first;
+                    u->sub[j] = level[i + j].second;
+                }
+                if constexpr (TALLIED) {
+                    std::copy(tallies.begin() + i, tallies.begin() + i + size, u->tally);
+                    upperTallies.push_back(tallyOf(*u));
+                }
+                upper.emplace_back(level[i].first, HardDisk::Record().save(file, *u));
+                i += size, rest -= size;
+            }
+            std::free(u);
+            level = std::move(upper);
+            tallies = std::move(upperTallies);
+        }
+
+        /* the writes the root held went to the node that took its place */
+        root->size = 0;
+        if constexpr (BUFFERED) root->pending = 0;
+        root->sub[0] = level[0].second;
+        if constexpr (TALLIED) root->tally[0] = tallies[0];
+        root->subIsLeaf = subIsLeaf;
+    }
+
+    /* apply a batch of writes with one descent per touched node instead of one per op. ops are
+     * sorted by key in place, ops on the same key take effect in their original order. returns
+     * the number of ops that changed the tree; in write-optimized mode the older writes held for
+     * their keys go down with them and are counted as well */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::apply_batch(std::span<op> ops) -> size_type {
+        std::stable_sort(ops.begin(), ops.end(), [this](const op &lhs, const op &rhs) { return key_le(lhs.key, rhs.key); });
+        Vec<key_type> wanted;
+        if constexpr (BUFFERED) for (const op &o: ops) wanted.push_back(o.key);
+        return deliver(ops, delivery::pull, wanted);
+    }
+
+    /* the writes of a batch without waiting for them to reach the leaves: in write-optimized mode
+     * they join the writes held by the root and only move down with them in bulk, so a write costs
+     * a small share of a node write. nothing is reported back, an insert of a key already there
+     * and an erase of a key not there just do nothing once they arrive. without MESSAGE_BUFFER this
+     * is apply_batch() */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::post(std::span<op> ops) -> void {
+        if constexpr (BUFFERED) {
+            std::stable_sort(ops.begin(), ops.end(), [this](const op &lhs, const op &rhs) { return key_le(lhs.key, rhs.key); });
+            deliver(ops, delivery::post, {});
+        } else apply_batch(ops);
+    }
+
+    /* hand the sorted ops to the root, how says how far the writes held on the way go with them,
+     * wanted are the sorted keys that pull takes down */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::deliver(std::span<op> ops, delivery how, std::span<const key_type> wanted) -> size_type {
+        u64 lsn = 0;
+        size_type applied = [&] {
+            auto quiet = writing();
+            auto guard = exclusive();
+
+            Vec<std::pair<key_type, HardDisk::Record>> split;
+            size_type changed = apply(*root, header.root, ops.data(), ops.data() + ops.size(), split, how, wanted);
+            if (root->size > 0 or not split.empty()) {
+                auto v = createNode<internal_node>(header.root);
+                *v = *root;
+                v.dirty();
+                Vec<tally_type> tallies;
+                if constexpr (TALLIED) {
+                    tallies.push_back(tallyOf(*v));
+                    for (auto &piece: split) tallies.push_back(tallyAt(false, piece.second));
+                }
+                split.emplace(split.begin(), key_type(), header.root);
+                stack(std::move(split), std::move(tallies), false, internal_node::MAX_SUB_NUM);
+                header.root = internalNodePool.alloc(header.root).save(file, *root);
+                if constexpr (not LOGGED) file.write_at(0, header);
+            }
+            /* posted ops may not have arrived yet */
+            if (changed > 0 or how == delivery::post)
+                for (const op &o: ops) lsn = logOp(o.type, o.key, o.value);
+            return changed;
+        }();
+        commit(lsn);
+        if constexpr (not CONCURRENT) if (applied > 0) tendFilter();
+        return applied;
+    }
+
+    /* walk the keys in [lo, hi] in ascending order, see cursor */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::scan(const key_type &lo, const key_type &hi, size_type readahead) -> cursor {
+        drain();
+        return cursor(this, lo, hi, false, readahead);
+    }
+
+    /* walk the keys in [lo, hi] in descending order, see cursor */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::rscan(const key_type &lo, const key_type &hi, size_type readahead) -> cursor {
+        drain();
+        return cursor(this, lo, hi, true, readahead);
+    }
+
+    /* what AGGREGATE folds keys [first, last) of u into */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::summarize(const leaf_node &u, size_type first, size_type last) -> aggregate_type {
+        aggregate_type result = aggregate_monoid::identity();
+        if constexpr (AGGREGATED)
+            for (; first < last; ++first) result = aggregate_monoid::combine(result, aggregate_monoid::of(u.key[first], loadSlot(u.rec[first])));
+        return result;
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::tallyOf(const leaf_node &u) -> tally_type {
+        tally_type result{};
+        if constexpr (COUNTED) result.count = u.size;
+        if constexpr (AGGREGATED) result.summary = summarize(u, 0, u.size);
+        return result;
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::tallyOf(const internal_node &u) -> tally_type {
+        tally_type result{};
+        if constexpr (COUNTED) for (size_type i = 0; i <= u.size; ++i) result.count += u.tally[i].count;
+        if constexpr (AGGREGATED) {
+            result.summary = aggregate_monoid::identity();
+            for (size_type i = 0; i <= u.size; ++i) result.summary = aggregate_monoid::combine(result.summary, u.tally[i].summary);
+        }
+        return result;
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::tallyAt(bool isLeaf, const HardDisk::Record &rec) -> tally_type {
+        if (isLeaf) return tallyOf(*nodeCache.template peek<leaf_node>(rec));
+        return tallyOf(*nodeCache.template peek<internal_node>(rec));
+    }
+
+    /* the number of keys less than key, or not greater than it if inclusive: the counts of the
+     * children left of the way down, and the place of key in its leaf */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::rankOf(const key_type &key, bool inclusive) -> size_type {
+        size_type rank = 0;
+        const internal_node *u = root;
+        HardDisk::BufferPool::view<internal_node> h;
+        for ( ; ; ) {
+            size_type loc = key_upper(u->key, u->size, key);
+            for (size_type i = 0; i < loc; ++i) rank += u->tally[i].count;
+            if (u->subIsLeaf) {
+                auto leaf = nodeCache.template peek<leaf_node>(u->sub[loc]);
+                return rank + (inclusive ? key_upper(leaf->key, leaf->size, key) : key_lower(leaf->key, leaf->size, key));
+            }
+            h = nodeCache.template peek<internal_node>(u->sub[loc]);
+            u = h.get();
+        }
+    }
+
+    /* the number of keys in the tree */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::size() const -> size_type {
+        static_assert(COUNTED, "bptree::size() needs ORDER_STATISTICS");
+        return tallyOf(*root).count;
+    }
+
+    /* the number of keys less than key, which is the place of key if it is in the tree */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::rank(const key_type &key) -> size_type {
+        static_assert(COUNTED, "bptree::rank() needs ORDER_STATISTICS");
+        return rankOf(key, false);
+    }
+
+    /* the key with i keys less than it, end() if there are not that many */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::nth(size_type i) -> iterator {
+        static_assert(COUNTED, "bptree::nth() needs ORDER_STATISTICS");
+        if (i >= size()) return end();
+        const internal_node *u = root;
+        HardDisk::BufferPool::view<internal_node> h;
+        for ( ; ; ) {
+            size_type loc = 0;
+            while (i >= u->tally[loc].count) i -= u->tally[loc++].count;
+            if (u->subIsLeaf) return iterator(this, u->sub[loc], *nodeCache.template peek<leaf_node>(u->sub[loc]), i);
+            h = nodeCache.template peek<internal_node>(u->sub[loc]);
+            u = h.get();
+        }
+    }
+
+    /* take up a value of key that was changed in place into the summaries on the way down to it */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::retally(internal_node &self, const key_type &key) -> void {
+        size_type loc = key_upper(self.key, self.size, key);
+        if (self.subIsLeaf) {
+            self.tally[loc] = tallyOf(*nodeCache.template peek<leaf_node>(self.sub[loc]));
+            return;
+        }
+        auto v = pinNode<internal_node>(self.sub[loc]);
+        retally(*v, key);
+        v.dirty();
+        self.tally[loc] = tallyOf(*v);
+    }
+
+    /* what AGGREGATE folds the keys under self into that are not less than *lo and not greater
+     * than *hi, where a null bound does not bound. children with both bounds past them count with
+     * their summaries, so below the child where lo and hi part only two paths are walked */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::aggregateOf(const internal_node &self, const key_type *lo, const key_type *hi) -> aggregate_type {
+        size_type first = lo ? key_upper(self.key, self.size, *lo) : 0, last = hi ? key_upper(self.key, self.size, *hi) : self.size;
+        aggregate_type result = aggregate_monoid::identity();
+        for (size_type loc = first; loc <= last; ++loc) {
+            const key_type *from = loc == first ? lo : nullptr, *to = loc == last ? hi : nullptr;
+            aggregate_type part;
+            if (not from and not to) part = self.tally[loc].summary;
+            else if (self.subIsLeaf) {
+                auto v = nodeCache.template peek<leaf_node>(self.sub[loc]);
+                part = summarize(*v, from ? key_lower(v->key, v->size, *from) : 0, to ? key_upper(v->key, v->size, *to) : v->size);
+            } else part = aggregateOf(*nodeCache.template peek<internal_node>(self.sub[loc]), from, to);
+            result = aggregate_monoid::combine(result, part);
+        }
+        return result;
+    }
+
+    /* the number of keys in [lo, hi], without visiting them */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::count(const key_type &lo, const key_type &hi) -> size_type {
+        static_assert(COUNTED, "bptree::count() needs ORDER_STATISTICS");
+        if (key_le(hi, lo)) return 0;
+        return rankOf(hi, true) - rankOf(lo, false);
+    }
+
+    /* what AGGREGATE folds the keys in [lo, hi] and their values into, in ascending order of the
+     * keys */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::aggregate(const key_type &lo, const key_type &hi) -> aggregate_type {
+        static_assert(AGGREGATED, "bptree::aggregate() needs AGGREGATE");
+        if (key_le(hi, lo)) return aggregate_monoid::identity();
+        return aggregateOf(*root, &lo, &hi);
+    }
 
 /* } */
 
-template <typename Key, typename Value, typename Compare, i32 FACTOR>
-class bptree<Key, Value, Compare, FACTOR>::iterator {
+template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+class bptree<Key, Value, Compare, FACTOR, Traits>::iterator {
 public:
     using Up    = bptree;
     using Self  = iterator;
 
     struct data_proxy;
 
-    Up          *up;
-    leaf_node   self;
-    i32         loc;
+    Up                  *up;
+    HardDisk::Record    node;
+    leaf_node           self;
+    i32                 loc;
 
 
 public:
-    iterator(): loc(-1) {}
-    iterator(Up *__up, leaf_node node, i32 __loc): up(__up), self(node), loc(__loc) {}
+    iterator(): up(nullptr), loc(-1) {}
+    iterator(Up *__up, HardDisk::Record __node, leaf_node leaf, i32 __loc): up(__up), node(__node), self(leaf), loc(__loc) {}
 
     auto operator + (difference_type diff) -> Self;
     auto operator - (difference_type diff) -> Self;
@@ -551,68 +2426,233 @@ public:
 
     // auto operator * () const -> value_type;
     auto operator * () const -> data_proxy;
+    /* the value without a proxy, for reads that are never written back */
+    auto value() const -> value_type {
+        if (loc < 0 or loc >= i32(self.size)) throw "dereference nullptr";
+        return up->loadSlot(self.rec[loc]);
+    }
 
     auto operator == (const Self &rhs) const -> bool {
         if (up != rhs.up or loc != rhs.loc) return false;
-        return loc == -1 or std::memcmp(std::addressof(self), std::addressof(rhs.self), sizeof(self)) == 0;
+        return loc == -1 or node.offset == rhs.node.offset;
     }
     auto operator != (const Self &rhs) const -> bool { return not (*this == rhs); }
 };
 
-/* impl bptree<Key, Value, Compare, FACTOR>::iterator { */
+/* impl bptree<Key, Value, Compare, FACTOR, Traits>::iterator { */
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::iterator::operator + (difference_type diff) -> Self {
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::iterator::operator + (difference_type diff) -> Self {
 		if (diff < 0) return *this - (-diff);
         iterator dst(*this);
+        /* past the next leaf it is quicker to count down from the root */
+        if constexpr (COUNTED)
+            if (loc >= 0 and diff >= difference_type(self.size) - loc + leaf_node::MAX_KEY_NUM)
+                return up->nth(up->rankOf(self.key[loc], false) + diff);
         for ( ; ; ) {
             difference_type rest = dst.self.size - dst.loc;
             if (diff < rest) return dst.loc += diff, dst;
-            if (dst.self.right.empty()) return iterator();
-            dst.self = dst.self.right.template get<leaf_node>(up->file);
+            if (dst.self.right.empty()) return up->end();
+            dst.node = dst.self.right;
+            dst.self = *up->nodeCache.template pin<leaf_node>(dst.node);
             dst.loc = 0;
             diff -= rest;
         }
     }
 
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::iterator::operator - (difference_type diff) -> Self {
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::iterator::operator - (difference_type diff) -> Self {
         if (diff < 0) return *this + (-diff);
         iterator dst(*this);
+        if constexpr (COUNTED)
+            if (loc >= 0 and diff > loc + leaf_node::MAX_KEY_NUM) {
+                size_type at = up->rankOf(self.key[loc], false);
+                return difference_type(at) < diff ? up->end() : up->nth(at - diff);
+            }
         for ( ; ; ) {
             difference_type rest = dst.loc;
             if (diff <= rest) return dst.loc -= diff, dst;
-            if (dst.self.left.empty()) return iterator();
-            dst.self = dst.self.left.template get<leaf_node>(up->file);
+            if (dst.self.left.empty()) return up->end();
+            dst.node = dst.self.left;
+            dst.self = *up->nodeCache.template pin<leaf_node>(dst.node);
             dst.loc = dst.self.size;
             diff -= rest;
         }
     }
 
-    // template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    // auto bptree<Key, Value, Compare, FACTOR>::iterator::operator * () const -> value_type {
+    // template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    // auto bptree<Key, Value, Compare, FACTOR, Traits>::iterator::operator * () const -> value_type {
     //     if (loc < 0 or loc >= self.size) throw "dereference nullptr";
     //     return self.rec[loc].template get<value_type>(up->file);
     // }
-    template <typename Key, typename Value, typename Compare, i32 FACTOR>
-    auto bptree<Key, Value, Compare, FACTOR>::iterator::operator * () const -> data_proxy {
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::iterator::operator * () const -> data_proxy {
         if (loc < 0 or loc >= i32(self.size)) throw "dereference nullptr";
-        return data_proxy(up->fileRef(), self.rec[loc]);
+        return data_proxy(up, node, loc, self.rec[loc]);
     }
 
 /* } */
 
-template <typename Key, typename Value, typename Compare, i32 FACTOR>
-struct bptree<Key, Value, Compare, FACTOR>::iterator::data_proxy {
-    HardDisk::FileWrapper &io;
-    HardDisk::Record rec;
+template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+struct bptree<Key, Value, Compare, FACTOR, Traits>::iterator::data_proxy {
+    Up *up;
+    HardDisk::Record node;
+    i32 loc;
     value_type value;
 
-    data_proxy(HardDisk::FileWrapper &__io, HardDisk::Record __rec): io(__io), rec(__rec) { rec.load(io, value); }
-    ~data_proxy() { rec.save(io, value); }
+    value_type loaded;
+
+    data_proxy(Up *__up, HardDisk::Record __node, i32 __loc, const slot_type &slot): up(__up), node(__node), loc(__loc), value(up->loadSlot(slot)), loaded(value) {}
+    data_proxy(const data_proxy &) = delete;
+    /* only a value that was changed through the proxy is written back */
+    ~data_proxy() {
+        if (same(value, loaded)) return;
+        u64 lsn;
+        {
+            auto leaf = up->nodeCache.template pin<leaf_node>(node);
+            lsn = up->store(*leaf, node, loc, value);
+            if constexpr (INLINE_VALUE or LOGGED or VARIABLE_VALUE) leaf.dirty();
+        }
+        up->commit(lsn);
+    }
+
+    auto operator = (const value_type &rhs) -> data_proxy& { value = rhs; return *this; }
 
     operator value_type&() { return value; }
     operator const value_type&() const { return value; }
 };
 
+/* a walk over the keys in [lo, hi] that hands out the entries of one leaf at a time. a background
+ * thread follows the sibling links through a file handle of its own and keeps up to readahead
+ * leaves (with their values) loaded in front of the reader. the tree is flushed when the cursor
+ * is opened and must not be written to while the cursor is alive */
+template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+class bptree<Key, Value, Compare, FACTOR, Traits>::cursor {
+public:
+    using Up            = bptree;
+    using Self          = cursor;
+    using entry_type    = std::pair<key_type, value_type>;
+
+private:
+    struct page {
+        HardDisk::Record            node;
+        std::unique_ptr<leaf_node>  self;
+        Vec<value_type>             values;
+    };
+
+    Up                      *up;
+    key_type                lo, hi;
+    bool                    reverse;
+    size_type               depth;
+    Vec<entry_type>         batch;
+
+    /* shared with the reader thread */
+    std::deque<page>        ahead;
+    bool                    stopping, exhausted;
+    std::mutex              mutex;
+    std::condition_variable cond;
+    std::thread             reader;
+
+    auto last(const leaf_node &self) const -> bool;
+    auto readahead(HardDisk::Record node) -> void;
+
+public:
+    cursor(Up *__up, const key_type &__lo, const key_type &__hi, bool __reverse, size_type readahead);
+    cursor(const Self &) = delete;
+    ~cursor();
+
+    /* the entries of the next leaf that has any in range, in scan order. empty once the range is
+     * exhausted, the span stays valid until the next call */
+    auto next() -> std::span<const entry_type>;
+};
+
+/* impl bptree<Key, Value, Compare, FACTOR, Traits>::cursor { */
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    bptree<Key, Value, Compare, FACTOR, Traits>::cursor::cursor(Up *__up, const key_type &__lo, const key_type &__hi, bool __reverse, size_type readahead)
+        : up(__up), lo(__lo), hi(__hi), reverse(__reverse), depth(std::max<size_type>(readahead, 1)), batch(), ahead(), stopping(false), exhausted(false) {
+        up->flush();
+        HardDisk::Record start = up->key_le(hi, lo) ? HardDisk::Record() : up->locate(reverse ? hi : lo);
+        reader = std::thread(&Self::readahead, this, start);
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    bptree<Key, Value, Compare, FACTOR, Traits>::cursor::~cursor() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        cond.notify_all();
+        reader.join();
+    }
+
+    /* whether the leaves beyond self in scan order are all out of range */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::cursor::last(const leaf_node &self) const -> bool {
+        if (self.size == 0) return false;
+        return reverse ? not up->key_le(lo, self.key[0]) : not up->key_le(self.key[self.size - 1], hi);
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::cursor::readahead(HardDisk::Record node) -> void {
+        HardDisk::FileWrapper io(up->fileName);
+        io.advise(HardDisk::access::sequential);
+        for (bool done = node.empty(); not done; ) {
+            page p{node, std::make_unique<leaf_node>(), Vec<value_type>()};
+            node.load(io, *p.self);
+            if constexpr (not INLINE_VALUE)
+                for (size_type i = 0; i < p.self->size; ++i) {
+                    if constexpr (VARIABLE_VALUE) {
+                        Vec<std::byte> bytes;
+                        HardDisk::ValueHeap::read(io, p.self->rec[i], bytes);
+                        p.values.push_back(HardDisk::from_bytes<value_type>(bytes));
+                    } else p.values.push_back(p.self->rec[i].template get<value_type>(io));
+                }
+            node = reverse ? p.self->left : p.self->right;
+            done = last(*p.self) or node.empty();
+
+            std::unique_lock lock(mutex);
+            cond.wait(lock, [this] { return stopping or ahead.size() < depth; });
+            if (stopping) return;
+            ahead.push_back(std::move(p));
+            cond.notify_all();
+        }
+        std::lock_guard lock(mutex);
+        exhausted = true;
+        cond.notify_all();
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto bptree<Key, Value, Compare, FACTOR, Traits>::cursor::next() -> std::span<const entry_type> {
+        batch.clear();
+        while (batch.empty()) {
+            page p;
+            {
+                std::unique_lock lock(mutex);
+                cond.wait(lock, [this] { return exhausted or not ahead.empty(); });
+                if (ahead.empty()) break;
+                p = std::move(ahead.front());
+                ahead.pop_front();
+            }
+            cond.notify_all();
+
+            const leaf_node &self = *p.self;
+            size_type from = up->key_lower(self.key, self.size, lo);
+            size_type to = up->key_upper(self.key, self.size, hi);
+            for (size_type i = from; i < to; ++i) {
+                if constexpr (INLINE_VALUE) batch.emplace_back(self.key[i], up->loadSlot(self.rec[i]));
+                else batch.emplace_back(self.key[i], std::move(p.values[i]));
+            }
+            if (reverse) std::reverse(batch.begin(), batch.end());
+        }
+        return batch;
+    }
+
+/* } */
+
 }
+
+template <size_t N>
+struct std::hash<__cpplib::key_string<N>> {
+    auto operator () (const __cpplib::key_string<N> &key) const -> size_t { return std::hash<std::string_view>()(key.view()); }
+};
@@ -0,0 +1,112 @@
+#pragma once
+#pragma message("the buffered_bptree.hpp header is included in your code base")
+
+#include "config.hpp"
+#include "rbtree.hpp"
+#include "bptree.hpp"
+
+namespace __cpplib {
+
+using namespace __config;
+
+/* A bptree with its writes held back in an rbtree. insert(), upsert() and erase() only note the
+ * latest write of every key in memory; once limit keys have one, they all go to the tree as one
+ * apply_batch() in key order, so that a leaf is written once per merge instead of once per write.
+ * Reads look at the buffer first and at the tree after. The tree is not looked at when a write is
+ * buffered, so writes report nothing back, and an insert only takes effect if its key is absent
+ * when it is merged. Everything else of the tree is reached through tree(), which merges first.
+ * Not thread-safe. */
+template <typename Key, typename Value, typename Compare = std::less<Key>, i32 FACTOR = 100, typename Traits = bptree_traits<Key, Value>>
+class buffered_bptree {
+    using Self              = buffered_bptree;
+
+public:
+    using tree_type         = bptree<Key, Value, Compare, FACTOR, Traits>;
+    using key_type          = Key;
+    using value_type        = Value;
+    using key_compare       = Compare;
+    using size_type         = size_t;
+    using op                = typename tree_type::op;
+
+    /* keys with a buffered write that trigger a merge; past a few hundred thousand the rbtree
+     * itself gets slow enough to eat up what larger batches save */
+    static constexpr size_type DEFAULT_LIMIT = size_type(1) << 18;
+
+private:
+    struct key_of_op {
+        auto operator () (const op &o) const -> const key_type& { return o.key; }
+    };
+
+    tree_type base;
+    rbtree<key_type, op, key_of_op, key_compare> buffer;
+    size_type limit;
+
+    auto put(typename op::type_t type, const key_type &key, const value_type &value) -> void;
+
+public:
+    buffered_bptree(const std::string &filename = std::string("data.bin"), size_type __limit = DEFAULT_LIMIT, size_type cacheBytes = HardDisk::BufferPool::DEFAULT_CAPACITY)
+        : base(filename, cacheBytes), buffer(), limit(std::max<size_type>(__limit, 1)) {}
+    buffered_bptree(const Self &) = delete;
+    ~buffered_bptree() { merge(); }
+
+    auto insert(const key_type &key, const value_type &value) -> void { put(op::insert, key, value); }
+    auto upsert(const key_type &key, const value_type &value) -> void { put(op::upsert, key, value); }
+    auto erase(const key_type &key) -> void { put(op::erase, key, value_type()); }
+
+    auto contains(const key_type &key) -> bool;
+    auto value(const key_type &key) -> value_type;
+
+    /* keys with a write waiting in the buffer */
+    auto buffered() const -> size_type { return buffer.size(); }
+    auto merge() -> void;
+    auto flush() -> void { merge(); base.flush(); }
+    auto tree() -> tree_type& { merge(); return base; }
+};
+
+/* impl buffered_bptree<Key, Value, Compare, FACTOR, Traits> { */
+
+    /* fold the write into the one buffered for its key, so that applying the result does what
+     * applying both in turn would */
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto buffered_bptree<Key, Value, Compare, FACTOR, Traits>::put(typename op::type_t type, const key_type &key, const value_type &value) -> void {
+        auto [it, fresh] = buffer.insert_unique(op{ type, key, value });
+        if (not fresh) {
+            op &o = *it;
+            if (type != op::insert) o.type = type, o.value = value;
+            /* the key is gone by then, the insert will find it absent */
+            else if (o.type == op::erase) o.type = op::upsert, o.value = value;
+        }
+        if (buffer.size() >= limit) merge();
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto buffered_bptree<Key, Value, Compare, FACTOR, Traits>::contains(const key_type &key) -> bool {
+        if (auto it = buffer.find(key); it != buffer.end()) return it->type != op::erase;
+        return base.find(key) != base.end();
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto buffered_bptree<Key, Value, Compare, FACTOR, Traits>::value(const key_type &key) -> value_type {
+        auto it = buffer.find(key);
+        if (it == buffer.end()) return base.value(key);
+        switch (it->type) {
+            case op::erase:     return value_type();
+            case op::upsert:    return it->value;
+            /* an insert loses to the key already in the tree */
+            default:            return base.find(key) != base.end() ? base.value(key) : it->value;
+        }
+    }
+
+    template <typename Key, typename Value, typename Compare, i32 FACTOR, typename Traits>
+    auto buffered_bptree<Key, Value, Compare, FACTOR, Traits>::merge() -> void {
+        if (buffer.empty()) return;
+        Vec<op> ops;
+        ops.reserve(buffer.size());
+        for (auto it = buffer.begin(); it != buffer.end(); ++it) ops.push_back(std::move(*it));
+        buffer.clear();
+        base.apply_batch(ops);
+    }
+
+/* } */
+
+}
@@ -0,0 +1,72 @@
+#include "config.hpp"
+#include "bptree.hpp"
+#include "timer.hpp"
+#include "random.hpp"
+// #include "debugger.hpp"
+#include "types.hpp"
+
+using namespace __cpplib::__config;
+
+using tree_t = __cpplib::bptree<Key, Value>;
+tree_t tree;
+
+auto main(i32, const char **argv) -> i32 {
+	const i32 num = std::stoi(argv[1]);
+	printf("num = %d\n", num);
+
+	Vec<std::pair<Key, Value>> data(num);
+	for (i32 i = 0; i < num; ++i) data[i].first = i;
+
+	Timer clk;
+	clk.start();
+	if (tree.bulk_load(data.begin(), data.end()) != size_t(num)) {
+		printf("wrong!");
+		exit(0);
+	}
+	printf("bulk_load done, time = %.2lf\n", clk.stop() / f64(CLOCKS_PER_SEC));
+
+	for (i32 i = 0; i < num; ++i) {
+		if (tree.value(data[i].first) != data[i].second) {
+			printf("wrong!");
+			exit(0);
+		}
+	}
+	printf("value done, time = %.2lf\n", clk.stop() / f64(CLOCKS_PER_SEC));
+
+	{
+		Vec<Key> keys(num);
+		for (i32 i = 0; i < num; ++i) keys[i] = data[num - 1 - i].first;
+		auto values = tree.multi_get(keys);
+		for (i32 i = 0; i < num; ++i) {
+			if (values[i] != data[num - 1 - i].second) {
+				printf("wrong!");
+				exit(0);
+			}
+		}
+	}
+	printf("multi_get done, time = %.2lf\n", clk.stop() / f64(CLOCKS_PER_SEC));
+
+	i32 cnt = 0;
+	for (auto it = tree.lower_bound(data[0].first); it != tree.end(); ++it) ++cnt;
+	if (cnt != num) {
+		printf("wrong!");
+		exit(0);
+	}
+	printf("scan done, time = %.2lf\n", clk.stop() / f64(CLOCKS_PER_SEC));
+
+	cnt = 0;
+	{
+		auto cur = tree.scan(data[0].first, data[num - 1].first);
+		for (auto batch = cur.next(); not batch.empty(); batch = cur.next()) cnt += batch.size();
+	}
+	if (cnt != num) {
+		printf("wrong!");
+		exit(0);
+	}
+	printf("cursor scan done, time = %.2lf\n", clk.stop() / f64(CLOCKS_PER_SEC));
+
+	for (i32 i = 0; i < num; ++i) tree.erase(data[i].first);
+	printf("erase done, time = %.2lf\n", clk.stop() / f64(CLOCKS_PER_SEC));
+
+	return 0;
+}